@@ -0,0 +1,291 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "BatchParser.h"
+#include "Clock.h"
+
+#include <OOBase/ArenaAllocator.h>
+#include <OOBase/Thread.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+BatchParser::BatchParser(OOBase::AllocatorInstance& allocator, size_t threads) :
+		m_allocator(allocator),
+		m_threads(threads ? threads : cpu_count()),
+		m_resolver(NULL),
+		m_workers(NULL),
+		m_worker_count(0),
+		m_names(NULL),
+		m_names_len(0),
+		m_names_alloc(0),
+		m_docs(allocator)
+{
+}
+
+BatchParser::~BatchParser()
+{
+	m_allocator.free(m_names);
+}
+
+size_t BatchParser::cpu_count()
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	long n = info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	long n = 1;
+#endif
+	return (n > 0 ? static_cast<size_t>(n) : 1);
+}
+
+int BatchParser::add(const char* fname)
+{
+	size_t len = strlen(fname) + 1;
+	if (m_names_len + len > m_names_alloc)
+	{
+		size_t new_alloc = (m_names_alloc ? m_names_alloc * 2 : 4096);
+		while (new_alloc < m_names_len + len)
+			new_alloc *= 2;
+
+		char* new_names = static_cast<char*>(m_allocator.reallocate(m_names,new_alloc,1));
+		if (!new_names)
+			return ENOMEM;
+
+		m_names = new_names;
+		m_names_alloc = new_alloc;
+	}
+
+	int err = m_docs.push_back(m_names_len);
+	if (err != 0)
+		return err;
+
+	memcpy(m_names + m_names_len,fname,len);
+	m_names_len += len;
+	return 0;
+}
+
+void BatchParser::set_resolver(Resolver& resolver)
+{
+	m_resolver = &resolver;
+}
+
+void BatchParser::run(Handler& handler)
+{
+	size_t docs = m_docs.size();
+	size_t threads = m_threads;
+	if (threads > docs)
+		threads = (docs ? docs : 1);
+
+	m_workers = static_cast<Worker*>(m_allocator.allocate(sizeof(Worker) * threads,OOBase::alignment_of<Worker>::value));
+	if (!m_workers)
+		throw "Out of memory";
+
+	// Start every worker with an equal contiguous share
+	m_worker_count = threads;
+	for (size_t i = 0;i < threads;++i)
+	{
+		Worker* w = ::new (&m_workers[i]) Worker();
+		w->m_parser = this;
+		w->m_handler = &handler;
+		w->m_index = i;
+		w->m_begin = docs * i / threads;
+		w->m_end = docs * (i + 1) / threads;
+	}
+
+	// The calling thread is a worker too
+	OOBase::Thread* pool = NULL;
+	size_t started = 0;
+	if (threads > 1)
+	{
+		pool = static_cast<OOBase::Thread*>(m_allocator.allocate(sizeof(OOBase::Thread) * (threads - 1),OOBase::alignment_of<OOBase::Thread>::value));
+		if (pool)
+		{
+			for (;started < threads - 1;++started)
+			{
+				::new (&pool[started]) OOBase::Thread(false);
+				if (pool[started].run(&worker,&m_workers[started + 1]) != 0)
+				{
+					// The share is stolen by the running workers
+					pool[started].~Thread();
+					break;
+				}
+			}
+		}
+	}
+
+	run_worker(m_workers[0]);
+
+	for (size_t i = 0;i < started;++i)
+	{
+		pool[i].join();
+		pool[i].~Thread();
+	}
+	m_allocator.free(pool);
+
+	for (size_t i = 0;i < threads;++i)
+		m_workers[i].~Worker();
+	m_allocator.free(m_workers);
+	m_workers = NULL;
+	m_worker_count = 0;
+}
+
+int BatchParser::worker(void* param)
+{
+	Worker* w = static_cast<Worker*>(param);
+	w->m_parser->run_worker(*w);
+	return 0;
+}
+
+void BatchParser::run_worker(Worker& w)
+{
+	// Shares nothing with the other workers while parsing
+	OOBase::ArenaAllocator allocator;
+	Tokenizer tok(allocator);
+	if (m_resolver)
+		tok.set_resolver(*m_resolver);
+
+	// The workers already keep the cores busy, a reader thread each would only add to them
+	tok.set_read_ahead(false);
+
+	OOBase::LocalString strToken(allocator);
+	for (;;)
+	{
+		size_t doc = 0;
+		if (take(w,doc))
+			parse(tok,strToken,*w.m_handler,doc);
+		else if (!steal(w))
+			break;
+	}
+
+	tok.reset();
+}
+
+bool BatchParser::take(Worker& w, size_t& doc)
+{
+	OOBase::Guard<OOBase::SpinLock> guard(w.m_lock);
+
+	if (w.m_begin == w.m_end)
+		return false;
+
+	doc = w.m_begin++;
+	return true;
+}
+
+bool BatchParser::steal(Worker& w)
+{
+	// No work is added once running, so when every share is empty the batch is done.
+	// A stolen range is briefly in neither share, but its thief is still running.
+	for (size_t i = 1;i < m_worker_count;++i)
+	{
+		Worker& victim = m_workers[(w.m_index + i) % m_worker_count];
+
+		size_t begin = 0,end = 0;
+		{
+			OOBase::Guard<OOBase::SpinLock> guard(victim.m_lock);
+
+			size_t remaining = victim.m_end - victim.m_begin;
+			if (!remaining)
+				continue;
+
+			// Take the back half, the victim keeps the documents nearest its cursor
+			end = victim.m_end;
+			begin = end - (remaining + 1) / 2;
+			victim.m_end = begin;
+		}
+
+		OOBase::Guard<OOBase::SpinLock> guard(w.m_lock);
+		w.m_begin = begin;
+		w.m_end = end;
+		return true;
+	}
+
+	return false;
+}
+
+void BatchParser::parse(Tokenizer& tok, OOBase::LocalString& strToken, Handler& handler, size_t doc)
+{
+	Result res;
+	res.m_doc = doc;
+	res.m_fname = m_names + m_docs[doc];
+	res.m_wf = false;
+	res.m_valid = false;
+	res.m_error = NULL;
+
+	char szError[256];
+	unsigned long long start = clock_ns();
+
+	Tokenizer::TokenType tok_type = Tokenizer::Error;
+	try
+	{
+		OOBase::LocalString strFName(tok.get_allocator());
+		if (strFName.assign(res.m_fname) != 0)
+			throw "Out of memory";
+
+		tok.load(strFName);
+
+		for (;;)
+		{
+			tok_type = tok.next_token(strToken);
+			if (tok_type == Tokenizer::End || tok_type == Tokenizer::Error)
+				break;
+
+			if (!handler.token(doc,tok_type,strToken))
+			{
+				res.m_error = "Stopped by handler";
+				break;
+			}
+		}
+
+		if (tok_type == Tokenizer::Error)
+		{
+			snprintf(szError,sizeof(szError),"Syntax error at %s, line %lu, col %lu",tok.get_location().c_str(),(unsigned long)tok.get_line(),(unsigned long)tok.get_column());
+			res.m_error = szError;
+		}
+	}
+	catch (const char* err)
+	{
+		tok_type = Tokenizer::Error;
+		snprintf(szError,sizeof(szError),"%s in %s",err,res.m_fname);
+		res.m_error = szError;
+	}
+
+	if (tok_type == Tokenizer::End)
+	{
+		res.m_wf = true;
+		res.m_valid = tok.is_valid();
+		if (!res.m_valid)
+			res.m_error = tok.get_validity_error().c_str();
+	}
+
+	res.m_ns = clock_ns() - start;
+	handler.result(res);
+}
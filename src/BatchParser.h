@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BATCHPARSER_H_INCLUDED_
+#define BATCHPARSER_H_INCLUDED_
+
+#include <OOBase/Mutex.h>
+#include <OOBase/Vector.h>
+
+#include "Tokenizer.h"
+
+// Parses many documents on a pool of threads.
+// Each worker owns an arena and a Tokenizer that is reset, not rebuilt, between documents,
+// and starts with a contiguous share of the documents, stealing half of another
+// worker's remaining share when its own runs out.
+class BatchParser
+{
+public:
+	struct Result
+	{
+		size_t             m_doc;     // Index in the order the documents were added
+		const char*        m_fname;
+		bool               m_wf;
+		bool               m_valid;
+		unsigned long long m_ns;
+		const char*        m_error;   // NULL, or the first syntax or validity error
+	};
+
+	// Called on the worker parsing the document, concurrently for different documents.
+	// Everything passed is only valid during the call.
+	class Handler
+	{
+	public:
+		// Return false to stop parsing the document
+		virtual bool token(size_t doc, Tokenizer::TokenType type, const OOBase::LocalString& strToken)
+		{
+			return true;
+		}
+
+		virtual void result(const Result& res) = 0;
+
+	protected:
+		Handler() {}
+		virtual ~Handler() {}
+	};
+
+	// threads = 0 uses every processor, the calling thread is one of the workers
+	BatchParser(OOBase::AllocatorInstance& allocator, size_t threads = 0);
+	~BatchParser();
+
+	// The name is copied
+	int add(const char* fname);
+
+	// The resolver is not owned, and must be safe to share between threads
+	void set_resolver(Resolver& resolver);
+
+	// Parses every document added so far, returns once all have been parsed
+	void run(Handler& handler);
+
+	static size_t cpu_count();
+
+private:
+	BatchParser(const BatchParser&);
+	BatchParser& operator = (const BatchParser&);
+
+	struct Worker
+	{
+		BatchParser*     m_parser;
+		Handler*         m_handler;
+		size_t           m_index;
+		OOBase::SpinLock m_lock;
+		size_t           m_begin;
+		size_t           m_end;
+	};
+
+	OOBase::AllocatorInstance& m_allocator;
+	size_t                     m_threads;
+	Resolver*                  m_resolver;
+	Worker*                    m_workers;
+	size_t                     m_worker_count;
+
+	// Every name, NUL terminated, back to back
+	char*  m_names;
+	size_t m_names_len;
+	size_t m_names_alloc;
+	OOBase::Vector<size_t,OOBase::AllocatorInstance> m_docs;
+
+	static int worker(void* param);
+	void run_worker(Worker& w);
+	bool take(Worker& w, size_t& doc);
+	bool steal(Worker& w);
+	void parse(Tokenizer& tok, OOBase::LocalString& strToken, Handler& handler, size_t doc);
+};
+
+#endif // BATCHPARSER_H_INCLUDED_
@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "Counters.h"
+
+#if defined(OOXML_COUNTERS)
+
+#include <string.h>
+
+void Counters::reset()
+{
+	memset(this,0,sizeof(*this));
+}
+
+void Counters::report(FILE* f) const
+{
+	static const char* const names[token_types] =
+	{
+		"Error", "End", "DocTypeStart", "DocTypeEnd", "ElementStart", "ElementEnd", "AttributeName",
+		"AttributeValue", "Text", "PiTarget", "PiData", "Comment", "CData"
+	};
+
+	fprintf(f,"bytes:             %llu\n",m_bytes);
+	fprintf(f,"tokens:");
+	for (size_t i = 0;i < token_types;++i)
+	{
+		if (m_tokens[i])
+			fprintf(f," %s=%llu",names[i],m_tokens[i]);
+	}
+	fprintf(f,"\n");
+	fprintf(f,"entity expansions: %llu\n",m_entity_expansions);
+	fprintf(f,"io push/pop:       %llu/%llu, max depth %lu\n",m_io_pushes,m_io_pops,static_cast<unsigned long>(m_io_max_depth));
+	fprintf(f,"pushback bytes:    %llu\n",m_pushback_bytes);
+	fprintf(f,"stack high-water:  %lu\n",static_cast<unsigned long>(m_stack_max));
+	fprintf(f,"decl/main ns:      %llu/%llu\n",m_init_ns,m_main_ns);
+}
+
+#endif // OOXML_COUNTERS
@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef COUNTERS_H_INCLUDED_
+#define COUNTERS_H_INCLUDED_
+
+// Hot-path counters, only built with OOXML_COUNTERS (configure --enable-counters).
+// OOXML_COUNT(stmt) compiles to nothing otherwise.
+
+#if defined(OOXML_COUNTERS)
+
+#include "Clock.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+struct Counters
+{
+	// One per Tokenizer::TokenType
+	static const size_t token_types = 13;
+
+	unsigned long long m_bytes;              // Bytes fed to the machine, including replacement text
+	unsigned long long m_tokens[token_types];
+	unsigned long long m_entity_expansions;
+	unsigned long long m_io_pushes;
+	unsigned long long m_io_pops;
+	size_t             m_io_depth;
+	size_t             m_io_max_depth;
+	unsigned long long m_pushback_bytes;     // Bytes ungot into IOState inputs
+	size_t             m_stack_max;          // Ragel call stack high-water
+	unsigned long long m_init_ns;            // In IOState::init, parsing XML and text declarations
+	unsigned long long m_main_ns;            // In the main machine, excluding m_init_ns
+
+	Counters()
+	{
+		reset();
+	}
+
+	void reset();
+	void report(FILE* f) const;
+};
+
+#define OOXML_COUNT(stmt) stmt
+
+#else
+
+#define OOXML_COUNT(stmt)
+
+#endif
+
+#endif // COUNTERS_H_INCLUDED_
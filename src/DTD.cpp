@@ -0,0 +1,937 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "DTD.h"
+
+#include <string.h>
+
+namespace
+{
+	const size_t no_node = size_t(-1);
+	const unsigned int no_state = static_cast<unsigned int>(-1);
+	const size_t no_element = size_t(-1);
+
+	// Position sets for the Glushkov construction, bit p is position p
+	class BitSets
+	{
+	public:
+		BitSets(OOBase::AllocatorInstance& allocator, size_t sets, size_t bits) :
+				m_allocator(allocator),
+				m_words((bits + 31) / 32),
+				m_bits(static_cast<unsigned int*>(allocator.allocate(sets * m_words * sizeof(unsigned int),OOBase::alignment_of<unsigned int>::value)))
+		{
+			if (!m_bits)
+				throw "Out of memory";
+
+			memset(m_bits,0,sets * m_words * sizeof(unsigned int));
+		}
+
+		~BitSets()
+		{
+			m_allocator.free(m_bits);
+		}
+
+		unsigned int* operator [] (size_t set) const
+		{
+			return m_bits + set * m_words;
+		}
+
+		void set(size_t s, size_t bit)
+		{
+			(*this)[s][bit / 32] |= (1U << (bit % 32));
+		}
+
+		bool test(const unsigned int* s, size_t bit) const
+		{
+			return (s[bit / 32] & (1U << (bit % 32))) != 0;
+		}
+
+		void merge(unsigned int* dest, const unsigned int* src) const
+		{
+			for (size_t i = 0;i < m_words;++i)
+				dest[i] |= src[i];
+		}
+
+		void copy(unsigned int* dest, const unsigned int* src) const
+		{
+			memcpy(dest,src,m_words * sizeof(unsigned int));
+		}
+
+		void clear(unsigned int* dest) const
+		{
+			memset(dest,0,m_words * sizeof(unsigned int));
+		}
+
+	private:
+		BitSets(const BitSets&);
+		BitSets& operator = (const BitSets&);
+
+		OOBase::AllocatorInstance& m_allocator;
+		size_t                     m_words;
+		unsigned int*              m_bits;
+	};
+}
+
+DTD::PairMap::PairMap(OOBase::AllocatorInstance& allocator) :
+		m_allocator(allocator),
+		m_slots(NULL),
+		m_alloc(0),
+		m_count(0)
+{
+}
+
+DTD::PairMap::~PairMap()
+{
+	m_allocator.free(m_slots);
+}
+
+void DTD::PairMap::clear()
+{
+	// Keep the capacity for the next document
+	m_count = 0;
+	if (m_slots)
+		memset(m_slots,0,m_alloc * sizeof(Slot));
+}
+
+size_t DTD::PairMap::find_slot(unsigned long long key) const
+{
+	size_t i = static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & (m_alloc - 1);
+	while (m_slots[i].m_key && m_slots[i].m_key != key)
+		i = (i + 1) & (m_alloc - 1);
+
+	return i;
+}
+
+void DTD::PairMap::grow()
+{
+	size_t old_alloc = m_alloc;
+	Slot* old = m_slots;
+
+	size_t new_alloc = (m_alloc ? m_alloc * 2 : 256);
+	m_slots = static_cast<Slot*>(m_allocator.allocate(new_alloc * sizeof(Slot),OOBase::alignment_of<Slot>::value));
+	if (!m_slots)
+	{
+		m_slots = old;
+		throw "Out of memory";
+	}
+
+	memset(m_slots,0,new_alloc * sizeof(Slot));
+	m_alloc = new_alloc;
+
+	for (size_t i = 0;i < old_alloc;++i)
+	{
+		if (old[i].m_key)
+			m_slots[find_slot(old[i].m_key)] = old[i];
+	}
+
+	m_allocator.free(old);
+}
+
+unsigned int DTD::PairMap::insert(unsigned int a, unsigned int b, unsigned int value)
+{
+	// Keep the table at most half full
+	if ((m_count + 1) * 2 > m_alloc)
+		grow();
+
+	unsigned long long key = ((static_cast<unsigned long long>(a) << 32) | b) + 1;
+	Slot& slot = m_slots[find_slot(key)];
+	if (slot.m_key)
+		return slot.m_value;
+
+	slot.m_key = key;
+	slot.m_value = value;
+	++m_count;
+	return value;
+}
+
+unsigned int DTD::PairMap::find(unsigned int a, unsigned int b) const
+{
+	if (!m_count)
+		return npos;
+
+	const Slot& slot = m_slots[find_slot(((static_cast<unsigned long long>(a) << 32) | b) + 1)];
+	return (slot.m_key ? slot.m_value : npos);
+}
+
+DTD::DTD(OOBase::AllocatorInstance& allocator) :
+		m_allocator(allocator),
+		m_names(allocator),
+		m_decls(allocator),
+		m_transitions(allocator),
+		m_accepting(NULL),
+		m_state_alloc(0),
+		m_state_count(0),
+		m_cm_element(NameTable::npos),
+		m_cm_kind(Children),
+		m_cm_ignore(false),
+		m_cm_last(no_node),
+		m_nodes(allocator),
+		m_groups(allocator),
+		m_attdefs(allocator),
+		m_att_map(allocator),
+		m_values(allocator),
+		m_ad_element(NameTable::npos),
+		m_ad_name(NameTable::npos),
+		m_ad_type(CData),
+		m_ad_default(Implied),
+		m_has_doctype(false),
+		m_doctype(NameTable::npos),
+		m_root_seen(false),
+		m_frames(allocator),
+		m_att_element(NameTable::npos),
+		m_att_current(no_att),
+		m_att_gen(0),
+		m_element_count(0),
+		m_element_offset(0),
+		m_ids(allocator),
+		m_id_entries(allocator),
+		m_strError(allocator)
+{
+}
+
+DTD::~DTD()
+{
+	m_allocator.free(m_accepting);
+}
+
+void DTD::reset()
+{
+	m_names.clear();
+	m_decls.clear();
+
+	m_transitions.clear();
+	m_state_count = 0;
+
+	m_nodes.clear();
+	m_groups.clear();
+	m_cm_element = NameTable::npos;
+	m_cm_ignore = false;
+
+	m_attdefs.clear();
+	m_att_map.clear();
+	m_values.clear();
+	m_ad_element = NameTable::npos;
+	m_ad_name = NameTable::npos;
+
+	m_has_doctype = false;
+	m_doctype = NameTable::npos;
+	m_root_seen = false;
+	m_frames.clear();
+	m_att_element = NameTable::npos;
+	m_att_current = no_att;
+	m_element_count = 0;
+	m_element_offset = 0;
+	m_ids.clear();
+	m_id_entries.clear();
+
+	m_strError.clear();
+}
+
+void DTD::error(const char* msg, const char* name, const char* name2)
+{
+	// Only the first error is kept, the rest are usually consequences of it
+	if (!m_strError.empty())
+		return;
+
+	int err = m_strError.assign(msg);
+	if (err == 0 && name)
+		err = m_strError.append(": ");
+	if (err == 0 && name)
+		err = m_strError.append(name);
+	if (err == 0 && name2)
+		err = m_strError.append(" in ");
+	if (err == 0 && name2)
+		err = m_strError.append(name2);
+	if (err != 0)
+		throw "Out of memory";
+}
+
+DTD::Decl& DTD::decl(unsigned int id)
+{
+	while (m_decls.size() <= id)
+	{
+		Decl d = { Undeclared, 0, no_att, no_att };
+		if (m_decls.push_back(d) != 0)
+			throw "Out of memory";
+	}
+	return m_decls[id];
+}
+
+void DTD::cm_element(const char* name, size_t len)
+{
+	m_cm_element = m_names.intern(name,len);
+	m_cm_kind = Children;
+	m_cm_last = no_node;
+	m_nodes.clear();
+	m_groups.clear();
+
+	// A repeated declaration is still parsed, but the first one stands
+	m_cm_ignore = (decl(m_cm_element).m_kind != Undeclared);
+	if (m_cm_ignore)
+		error("VC: Unique Element Type Declaration",m_names.name(m_cm_element));
+}
+
+void DTD::cm_empty()
+{
+	m_cm_kind = Empty;
+}
+
+void DTD::cm_any()
+{
+	m_cm_kind = Any;
+}
+
+void DTD::cm_mixed()
+{
+	m_cm_kind = Mixed;
+}
+
+size_t DTD::add_node(unsigned char type, unsigned int sym)
+{
+	Node n;
+	n.m_type = type;
+	n.m_repeat = '\0';
+	n.m_sym = sym;
+	n.m_pos = 0;
+	n.m_first_child = no_node;
+	n.m_last_child = no_node;
+	n.m_next = no_node;
+
+	if (m_nodes.push_back(n) != 0)
+		throw "Out of memory";
+
+	return m_nodes.size() - 1;
+}
+
+void DTD::add_child(size_t node)
+{
+	if (m_groups.empty())
+		return;
+
+	Node& parent = m_nodes[m_groups[m_groups.size()-1]];
+	if (parent.m_last_child == no_node)
+		parent.m_first_child = node;
+	else
+		m_nodes[parent.m_last_child].m_next = node;
+	parent.m_last_child = node;
+}
+
+void DTD::cm_open()
+{
+	// A group is a sequence until a '|' says otherwise
+	size_t node = add_node(Node::Seq,0);
+	add_child(node);
+
+	if (m_groups.push_back(node) != 0)
+		throw "Out of memory";
+}
+
+void DTD::cm_close()
+{
+	m_groups.pop_back(&m_cm_last);
+}
+
+void DTD::cm_name(const char* name, size_t len)
+{
+	size_t node = add_node(Node::Name,m_names.intern(name,len));
+	add_child(node);
+	m_cm_last = node;
+}
+
+void DTD::cm_choice()
+{
+	if (!m_groups.empty())
+		m_nodes[m_groups[m_groups.size()-1]].m_type = Node::Choice;
+}
+
+void DTD::cm_seq()
+{
+	if (!m_groups.empty())
+		m_nodes[m_groups[m_groups.size()-1]].m_type = Node::Seq;
+}
+
+void DTD::cm_repeat(char r)
+{
+	if (m_cm_last != no_node)
+		m_nodes[m_cm_last].m_repeat = r;
+}
+
+void DTD::cm_end()
+{
+	if (m_cm_element == NameTable::npos || m_cm_ignore)
+		return;
+
+	switch (m_cm_kind)
+	{
+	case Empty:
+	case Any:
+		decl(m_cm_element).m_kind = m_cm_kind;
+		break;
+
+	case Mixed:
+		compile_mixed();
+		break;
+
+	case Children:
+	default:
+		compile_children();
+		break;
+	}
+
+	m_cm_element = NameTable::npos;
+}
+
+void DTD::att_element(const char* name, size_t len)
+{
+	m_ad_element = m_names.intern(name,len);
+}
+
+void DTD::att_name(const char* name, size_t len)
+{
+	m_ad_name = m_names.intern(name,len);
+	m_ad_type = CData;
+	m_ad_default = Value;
+}
+
+void DTD::att_type(AttType type)
+{
+	m_ad_type = static_cast<unsigned char>(type);
+}
+
+void DTD::att_default(AttDefault def)
+{
+	m_ad_default = static_cast<unsigned char>(def);
+}
+
+void DTD::att_def(const char* value, size_t len)
+{
+	if (m_ad_element == NameTable::npos || m_ad_name == NameTable::npos)
+		return;
+
+	// The first declaration of an attribute binds, later ones are ignored
+	unsigned int idx = static_cast<unsigned int>(m_attdefs.size());
+	if (m_att_map.insert(m_ad_element,m_ad_name,idx) == idx)
+	{
+		if (m_ad_type == Id && m_ad_default != Implied && m_ad_default != Required)
+			error("VC: ID Attribute Default",m_names.name(m_ad_name),m_names.name(m_ad_element));
+
+		AttDef a;
+		a.m_name = m_ad_name;
+		a.m_type = m_ad_type;
+		a.m_default = m_ad_default;
+		a.m_value = m_values.length();
+		a.m_value_len = len;
+		a.m_next = no_att;
+		a.m_seen = 0;
+
+		if (m_ad_default == Fixed || m_ad_default == Value)
+			m_values.append(value,len);
+
+		if (m_attdefs.push_back(a) != 0)
+			throw "Out of memory";
+
+		// Keep declaration order, so defaults are supplied predictably
+		Decl& d = decl(m_ad_element);
+		if (d.m_last_att == no_att)
+			d.m_first_att = idx;
+		else
+			m_attdefs[d.m_last_att].m_next = idx;
+		d.m_last_att = idx;
+	}
+
+	m_ad_name = NameTable::npos;
+}
+
+unsigned int DTD::new_states(size_t count)
+{
+	if (m_state_count + count > m_state_alloc)
+	{
+		size_t new_alloc = (m_state_alloc ? m_state_alloc * 2 : 256);
+		while (new_alloc < m_state_count + count)
+			new_alloc *= 2;
+
+		unsigned char* new_accepting = static_cast<unsigned char*>(m_allocator.reallocate(m_accepting,new_alloc,1));
+		if (!new_accepting)
+			throw "Out of memory";
+
+		m_accepting = new_accepting;
+		m_state_alloc = new_alloc;
+	}
+
+	unsigned int base = m_state_count;
+	memset(m_accepting + base,0,count);
+	m_state_count += static_cast<unsigned int>(count);
+	return base;
+}
+
+bool DTD::add_transition(unsigned int from, unsigned int sym, unsigned int to)
+{
+	return (m_transitions.insert(from,sym,to) == to);
+}
+
+unsigned int DTD::next_state(unsigned int from, unsigned int sym) const
+{
+	return m_transitions.find(from,sym);
+}
+
+void DTD::compile_mixed()
+{
+	// (#PCDATA|a|b)* is a single accepting state looping on each name
+	unsigned int s = new_states(1);
+	m_accepting[s] = 1;
+
+	if (!m_nodes.empty())
+	{
+		for (size_t c = m_nodes[0].m_first_child;c != no_node;c = m_nodes[c].m_next)
+		{
+			if (next_state(s,m_nodes[c].m_sym) != no_state)
+				error("VC: No Duplicate Types",m_names.name(m_nodes[c].m_sym),m_names.name(m_cm_element));
+			else
+				add_transition(s,m_nodes[c].m_sym,s);
+		}
+	}
+
+	Decl& d = decl(m_cm_element);
+	d.m_kind = Mixed;
+	d.m_start = s;
+}
+
+void DTD::compile_children()
+{
+	// Glushkov construction: one state per name occurrence (position) plus a start state.
+	// The result is deterministic exactly when the content model is, as XML requires.
+	size_t nodes = m_nodes.size();
+	if (!nodes)
+		return;
+
+	size_t positions = 0;
+	for (size_t i = 0;i < nodes;++i)
+	{
+		if (m_nodes[i].m_type == Node::Name)
+			m_nodes[i].m_pos = ++positions;
+	}
+
+	BitSets first(m_allocator,nodes,positions + 1);
+	BitSets last(m_allocator,nodes,positions + 1);
+	BitSets follow(m_allocator,positions + 2,positions + 1);
+	unsigned int* running = follow[positions + 1];
+
+	unsigned char* nullable = static_cast<unsigned char*>(m_allocator.allocate(nodes,1));
+	unsigned int* syms = static_cast<unsigned int*>(m_allocator.allocate((positions + 1) * sizeof(unsigned int),OOBase::alignment_of<unsigned int>::value));
+	if (!nullable || !syms)
+	{
+		m_allocator.free(nullable);
+		m_allocator.free(syms);
+		throw "Out of memory";
+	}
+
+	// Children always follow their group, so walk backwards
+	for (size_t i = nodes;i-- > 0;)
+	{
+		const Node& n = m_nodes[i];
+		if (n.m_type == Node::Name)
+		{
+			syms[n.m_pos] = n.m_sym;
+			first.set(i,n.m_pos);
+			last.set(i,n.m_pos);
+			nullable[i] = 0;
+		}
+		else if (n.m_type == Node::Choice)
+		{
+			nullable[i] = 0;
+			for (size_t c = n.m_first_child;c != no_node;c = m_nodes[c].m_next)
+			{
+				first.merge(first[i],first[c]);
+				last.merge(last[i],last[c]);
+				if (nullable[c])
+					nullable[i] = 1;
+			}
+		}
+		else
+		{
+			nullable[i] = 1;
+			first.clear(running);
+			for (size_t c = n.m_first_child;c != no_node;c = m_nodes[c].m_next)
+			{
+				if (nullable[i])
+					first.merge(first[i],first[c]);
+
+				// Everything that may end the sequence so far is followed by this child
+				for (size_t p = 1;p <= positions;++p)
+				{
+					if (first.test(running,p))
+						follow.merge(follow[p],first[c]);
+				}
+
+				if (nullable[c])
+					first.merge(running,last[c]);
+				else
+				{
+					first.copy(running,last[c]);
+					nullable[i] = 0;
+				}
+			}
+			last.copy(last[i],running);
+		}
+
+		if (n.m_repeat == '*' || n.m_repeat == '+')
+		{
+			for (size_t p = 1;p <= positions;++p)
+			{
+				if (last.test(last[i],p))
+					follow.merge(follow[p],first[i]);
+			}
+		}
+
+		if (n.m_repeat == '*' || n.m_repeat == '?')
+			nullable[i] = 1;
+	}
+
+	unsigned int base = new_states(positions + 1);
+	m_accepting[base] = nullable[0];
+
+	bool deterministic = true;
+	for (size_t q = 1;q <= positions;++q)
+	{
+		if (last.test(last[0],q))
+			m_accepting[base + q] = 1;
+
+		if (first.test(first[0],q) && !add_transition(base,syms[q],base + static_cast<unsigned int>(q)))
+			deterministic = false;
+	}
+
+	for (size_t p = 1;p <= positions;++p)
+	{
+		for (size_t q = 1;q <= positions;++q)
+		{
+			if (follow.test(follow[p],q) && !add_transition(base + static_cast<unsigned int>(p),syms[q],base + static_cast<unsigned int>(q)))
+				deterministic = false;
+		}
+	}
+
+	m_allocator.free(nullable);
+	m_allocator.free(syms);
+
+	if (!deterministic)
+		error("Non-deterministic content model",m_names.name(m_cm_element));
+
+	Decl& d = decl(m_cm_element);
+	d.m_kind = Children;
+	d.m_start = base;
+}
+
+void DTD::doctype(const char* name, size_t len)
+{
+	m_has_doctype = true;
+	m_doctype = m_names.intern(name,len);
+}
+
+void DTD::element_start(const char* name, size_t len, unsigned long long offset)
+{
+	// Names that were never declared or referenced cannot be valid, so need not be interned
+	unsigned int id = m_names.find(name,len);
+
+	m_att_element = id;
+	m_att_current = no_att;
+	++m_att_gen;
+	++m_element_count;
+	m_element_offset = offset;
+
+	if (!m_has_doctype)
+	{
+		if (!m_root_seen)
+		{
+			m_root_seen = true;
+			error("No DOCTYPE");
+		}
+		return;
+	}
+
+	unsigned char kind = (id < m_decls.size() ? m_decls[id].m_kind : static_cast<unsigned char>(Undeclared));
+
+	if (!m_root_seen)
+	{
+		m_root_seen = true;
+		if (id != m_doctype)
+			error("VC: Root Element Type",m_names.name(m_doctype));
+	}
+	else if (!m_frames.empty())
+	{
+		Frame& parent = m_frames[m_frames.size()-1];
+		if (parent.m_element != NameTable::npos)
+		{
+			switch (m_decls[parent.m_element].m_kind)
+			{
+			case Empty:
+				error("VC: Element Valid, EMPTY element has content",m_names.name(parent.m_element));
+				break;
+
+			case Mixed:
+			case Children:
+				{
+					unsigned int next = (id == NameTable::npos ? no_state : next_state(parent.m_state,id));
+					if (next == no_state)
+						error("VC: Element Valid, element not allowed",id == NameTable::npos ? "undeclared element" : m_names.name(id),m_names.name(parent.m_element));
+					else if (m_decls[parent.m_element].m_kind == Children)
+						parent.m_state = next;
+				}
+				break;
+
+			default:
+				break;
+			}
+		}
+	}
+
+	Frame f;
+	f.m_element = NameTable::npos;
+	f.m_state = no_state;
+	if (kind == Undeclared)
+		error("VC: Element Valid, element not declared",id == NameTable::npos ? "" : m_names.name(id));
+	else
+	{
+		f.m_element = id;
+		f.m_state = m_decls[id].m_start;
+	}
+
+	if (m_frames.push_back(f) != 0)
+		throw "Out of memory";
+}
+
+void DTD::element_end()
+{
+	Frame f;
+	if (!m_has_doctype || !m_frames.pop_back(&f))
+		return;
+
+	if (f.m_element != NameTable::npos && m_decls[f.m_element].m_kind == Children && !m_accepting[f.m_state])
+		error("VC: Element Valid, content incomplete",m_names.name(f.m_element));
+}
+
+void DTD::text(const char* text, size_t len)
+{
+	if (!m_has_doctype || m_frames.empty())
+		return;
+
+	const Frame& f = m_frames[m_frames.size()-1];
+	if (f.m_element == NameTable::npos)
+		return;
+
+	switch (m_decls[f.m_element].m_kind)
+	{
+	case Empty:
+		error("VC: Element Valid, EMPTY element has content",m_names.name(f.m_element));
+		break;
+
+	case Children:
+		for (size_t i = 0;i < len;++i)
+		{
+			if (text[i] != ' ' && text[i] != '\t' && text[i] != '\r' && text[i] != '\n')
+			{
+				error("VC: Element Valid, character data in element content",m_names.name(f.m_element));
+				break;
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+void DTD::cdata()
+{
+	if (!m_has_doctype || m_frames.empty())
+		return;
+
+	const Frame& f = m_frames[m_frames.size()-1];
+	if (f.m_element == NameTable::npos)
+		return;
+
+	unsigned char kind = m_decls[f.m_element].m_kind;
+	if (kind == Empty)
+		error("VC: Element Valid, EMPTY element has content",m_names.name(f.m_element));
+	else if (kind == Children)
+		error("VC: Element Valid, CDATA section in element content",m_names.name(f.m_element));
+}
+
+void DTD::markup()
+{
+	if (!m_has_doctype || m_frames.empty())
+		return;
+
+	const Frame& f = m_frames[m_frames.size()-1];
+	if (f.m_element != NameTable::npos && m_decls[f.m_element].m_kind == Empty)
+		error("VC: Element Valid, EMPTY element has content",m_names.name(f.m_element));
+}
+
+void DTD::attribute_name(const char* name, size_t len)
+{
+	m_att_current = no_att;
+
+	unsigned int id = (m_att_element == NameTable::npos ? NameTable::npos : m_names.find(name,len));
+	if (id != NameTable::npos)
+	{
+		unsigned int idx = m_att_map.find(m_att_element,id);
+		if (idx != PairMap::npos)
+		{
+			m_att_current = idx;
+			m_attdefs[idx].m_seen = m_att_gen;
+			return;
+		}
+	}
+
+	if (m_has_doctype && m_att_element != NameTable::npos)
+	{
+		OOBase::LocalString strName(m_allocator);
+		if (strName.assign(name,len) != 0)
+			throw "Out of memory";
+
+		error("VC: Attribute Value Type, attribute not declared",strName.c_str(),m_names.name(m_att_element));
+	}
+}
+
+void DTD::attribute_value(const char* value, size_t len)
+{
+	if (m_att_current == no_att)
+		return;
+
+	const AttDef& a = m_attdefs[m_att_current];
+	if (a.m_default == Fixed && (a.m_value_len != len || memcmp(m_values.data() + a.m_value,value,len) != 0))
+		error("VC: Fixed Attribute Default",m_names.name(a.m_name),m_names.name(m_att_element));
+
+	switch (a.m_type)
+	{
+	case Id:
+		{
+			IdEntry& e = id_entry(value,len);
+			if (e.m_element != no_element)
+				error("VC: ID, value is not unique",m_ids.name(m_ids.find(value,len)));
+			else
+			{
+				e.m_element = m_element_count - 1;
+				e.m_offset = m_element_offset;
+			}
+		}
+		break;
+
+	case IdRef:
+		id_ref(value,len);
+		break;
+
+	case IdRefs:
+		// Already normalised to single spaces
+		for (size_t start = 0;start < len;)
+		{
+			size_t end = start;
+			while (end < len && value[end] != ' ')
+				++end;
+
+			id_ref(value + start,end - start);
+			start = end + 1;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	m_att_current = no_att;
+}
+
+void DTD::attributes_end()
+{
+	m_att_current = no_att;
+
+	for (size_t i = first_default();i != no_att;i = m_attdefs[i].m_next)
+	{
+		const AttDef& a = m_attdefs[i];
+		if (a.m_default == Required && a.m_seen != m_att_gen)
+			error("VC: Required Attribute",m_names.name(a.m_name),m_names.name(m_att_element));
+	}
+}
+
+size_t DTD::first_default() const
+{
+	if (m_att_element == NameTable::npos || m_att_element >= m_decls.size())
+		return no_att;
+
+	return m_decls[m_att_element].m_first_att;
+}
+
+bool DTD::next_default(size_t& i, const char*& name, const char*& value, size_t& len) const
+{
+	for (;i != no_att;i = m_attdefs[i].m_next)
+	{
+		const AttDef& a = m_attdefs[i];
+		if ((a.m_default == Fixed || a.m_default == Value) && a.m_seen != m_att_gen)
+		{
+			name = m_names.name(a.m_name);
+			value = m_values.data() + a.m_value;
+			len = a.m_value_len;
+
+			i = a.m_next;
+			return true;
+		}
+	}
+	return false;
+}
+
+DTD::IdEntry& DTD::id_entry(const char* value, size_t len)
+{
+	unsigned int id = m_ids.intern(value,len);
+	while (m_id_entries.size() <= id)
+	{
+		IdEntry e = { no_element, 0, false };
+		if (m_id_entries.push_back(e) != 0)
+			throw "Out of memory";
+	}
+	return m_id_entries[id];
+}
+
+void DTD::id_ref(const char* value, size_t len)
+{
+	// Targets may follow their references, so they are checked at the end
+	id_entry(value,len).m_referenced = true;
+}
+
+void DTD::document_end()
+{
+	for (size_t i = 0;i < m_id_entries.size();++i)
+	{
+		if (m_id_entries[i].m_referenced && m_id_entries[i].m_element == no_element)
+		{
+			error("VC: IDREF, no element has the ID",m_ids.name(static_cast<unsigned int>(i)));
+			break;
+		}
+	}
+}
+
+bool DTD::find_id(const char* value, size_t len, size_t& element, unsigned long long& offset) const
+{
+	unsigned int id = m_ids.find(value,len);
+	if (id == NameTable::npos || m_id_entries[id].m_element == no_element)
+		return false;
+
+	element = m_id_entries[id].m_element;
+	offset = m_id_entries[id].m_offset;
+	return true;
+}
@@ -0,0 +1,292 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DTD_H_INCLUDED_
+#define DTD_H_INCLUDED_
+
+#include <OOBase/String.h>
+#include <OOBase/Vector.h>
+
+#include "NameTable.h"
+#include "Token.h"
+
+// Element and attribute-list declarations compiled to deterministic automata, over interned
+// element names, and run incrementally against the document's tokens.
+// Validity errors are recorded, not thrown: a document may be well-formed but invalid.
+class DTD
+{
+public:
+	DTD(OOBase::AllocatorInstance& allocator);
+	~DTD();
+
+	void reset();
+
+	// Content model construction, driven by the elementdecl grammar
+	void cm_element(const char* name, size_t len);
+	void cm_empty();
+	void cm_any();
+	void cm_mixed();
+	void cm_open();
+	void cm_close();
+	void cm_name(const char* name, size_t len);
+	void cm_choice();
+	void cm_seq();
+	void cm_repeat(char r);
+	void cm_end();
+
+	enum AttType
+	{
+		CData = 0,
+		Id,
+		IdRef,
+		IdRefs,
+		Entity,
+		Entities,
+		NmToken,
+		NmTokens,
+		Notation,
+		Enumeration
+	};
+
+	enum AttDefault
+	{
+		Implied = 0,
+		Required,
+		Fixed,
+		Value
+	};
+
+	// Attribute list construction, driven by the AttlistDecl grammar
+	void att_element(const char* name, size_t len);
+	void att_name(const char* name, size_t len);
+	void att_type(AttType type);
+	void att_default(AttDefault def);
+	void att_def(const char* value, size_t len);
+
+	// Is the attribute being declared normalised as a tokenized type?
+	bool att_decl_tokenized() const
+	{
+		return (m_ad_type != CData);
+	}
+
+	// Validation, driven by the document's tokens
+	void doctype(const char* name, size_t len);
+	void element_start(const char* name, size_t len, unsigned long long offset);
+	void element_end();
+	void attribute_name(const char* name, size_t len);
+	void attribute_value(const char* value, size_t len);
+	void attributes_end();
+	void text(const char* text, size_t len);
+	void cdata();
+	void markup();
+	void document_end();
+
+	// Is the current attribute normalised as a tokenized type?
+	bool att_tokenized() const
+	{
+		return (m_att_current != no_att && m_attdefs[m_att_current].m_type != CData);
+	}
+
+	// Where an ID value was declared: the element's ordinal in document order,
+	// and the byte offset of its start tag in the document, see IOState::get_offset()
+	bool find_id(const char* value, size_t len, size_t& element, unsigned long long& offset) const;
+
+	// Iterates the defaulted attributes the current element did not specify
+	size_t first_default() const;
+	bool next_default(size_t& i, const char*& name, const char*& value, size_t& len) const;
+
+	bool is_valid() const
+	{
+		return m_strError.empty();
+	}
+
+	// The first validity error, or an empty string
+	const OOBase::LocalString& error() const
+	{
+		return m_strError;
+	}
+
+private:
+	DTD(const DTD&);
+	DTD& operator = (const DTD&);
+
+	static const size_t no_att = size_t(-1);
+
+	// Open addressed map from a pair of ids to an id
+	class PairMap
+	{
+	public:
+		static const unsigned int npos = static_cast<unsigned int>(-1);
+
+		PairMap(OOBase::AllocatorInstance& allocator);
+		~PairMap();
+
+		void clear();
+
+		// Returns the existing value if the pair is already present
+		unsigned int insert(unsigned int a, unsigned int b, unsigned int value);
+		unsigned int find(unsigned int a, unsigned int b) const;
+
+	private:
+		PairMap(const PairMap&);
+		PairMap& operator = (const PairMap&);
+
+		struct Slot
+		{
+			unsigned long long m_key;   // (a << 32 | b) + 1, 0 is empty
+			unsigned int       m_value;
+		};
+
+		OOBase::AllocatorInstance& m_allocator;
+		Slot*                      m_slots;
+		size_t                     m_alloc;
+		size_t                     m_count;
+
+		size_t find_slot(unsigned long long key) const;
+		void grow();
+	};
+
+	enum Kind
+	{
+		Undeclared = 0,
+		Empty,
+		Any,
+		Mixed,
+		Children
+	};
+
+	struct Decl
+	{
+		unsigned char m_kind;
+		unsigned int  m_start;
+		size_t        m_first_att;
+		size_t        m_last_att;
+	};
+
+	struct AttDef
+	{
+		unsigned int  m_name;
+		unsigned char m_type;
+		unsigned char m_default;
+		size_t        m_value;      // Offset into m_values
+		size_t        m_value_len;
+		size_t        m_next;
+		unsigned long m_seen;       // Generation of the last element that specified it
+	};
+
+	struct Node
+	{
+		enum Type
+		{
+			Name,
+			Seq,
+			Choice
+		};
+
+		unsigned char m_type;
+		char          m_repeat;
+		unsigned int  m_sym;
+		size_t        m_pos;
+		size_t        m_first_child;
+		size_t        m_last_child;
+		size_t        m_next;
+	};
+
+	struct IdEntry
+	{
+		size_t             m_element;   // no_element until declared
+		unsigned long long m_offset;
+		bool               m_referenced;
+	};
+
+	struct Frame
+	{
+		unsigned int m_element;
+		unsigned int m_state;
+	};
+
+	OOBase::AllocatorInstance& m_allocator;
+	NameTable                  m_names;
+
+	OOBase::Vector<Decl,OOBase::AllocatorInstance> m_decls;
+
+	// The compiled automata, states are numbered across every element
+	PairMap        m_transitions;
+	unsigned char* m_accepting;
+	size_t         m_state_alloc;
+	unsigned int   m_state_count;
+
+	// The content model being built
+	unsigned int  m_cm_element;
+	unsigned char m_cm_kind;
+	bool          m_cm_ignore;
+	size_t        m_cm_last;
+	OOBase::Vector<Node,OOBase::AllocatorInstance>   m_nodes;
+	OOBase::Vector<size_t,OOBase::AllocatorInstance> m_groups;
+
+	// Attribute definitions, keyed by (element, attribute)
+	OOBase::Vector<AttDef,OOBase::AllocatorInstance> m_attdefs;
+	PairMap       m_att_map;
+	Token         m_values;
+
+	// The attribute definition being built
+	unsigned int  m_ad_element;
+	unsigned int  m_ad_name;
+	unsigned char m_ad_type;
+	unsigned char m_ad_default;
+
+	// Validation state
+	bool         m_has_doctype;
+	unsigned int m_doctype;
+	bool         m_root_seen;
+	OOBase::Vector<Frame,OOBase::AllocatorInstance> m_frames;
+
+	// The element whose attributes are being emitted
+	unsigned int       m_att_element;
+	size_t             m_att_current;
+	unsigned long      m_att_gen;
+	size_t             m_element_count;
+	unsigned long long m_element_offset;
+
+	// ID values and IDREF targets, both interned in m_ids
+	NameTable m_ids;
+	OOBase::Vector<IdEntry,OOBase::AllocatorInstance> m_id_entries;
+
+	OOBase::LocalString m_strError;
+
+	void error(const char* msg, const char* name = NULL, const char* name2 = NULL);
+
+	Decl& decl(unsigned int id);
+	size_t add_node(unsigned char type, unsigned int sym);
+	void add_child(size_t node);
+
+	unsigned int new_states(size_t count);
+	bool add_transition(unsigned int from, unsigned int sym, unsigned int to);
+	unsigned int next_state(unsigned int from, unsigned int sym) const;
+
+	IdEntry& id_entry(const char* value, size_t len);
+	void id_ref(const char* value, size_t len);
+
+	void compile_mixed();
+	void compile_children();
+};
+
+#endif // DTD_H_INCLUDED_
@@ -22,8 +22,11 @@
 #ifndef DECODER_H_INCLUDED_
 #define DECODER_H_INCLUDED_
 
-#include <OOBase/Memory.h>
+#include <stddef.h>
 
+// Decoders only need to handle ASCII 0x01..0x7F, enough to read the XML declaration.
+// There are no virtual calls: IOState switches on type() once per block and then
+// runs a loop over the matching next<T>() specialisation, which is inlined.
 class Decoder
 {
 public:
@@ -37,39 +40,103 @@ public:
 		EBCDIC
 	};
 
-	static Decoder* create(OOBase::AllocatorInstance& allocator, eType type);
+	Decoder() : m_type(None), m_count(0)
+	{}
 
-	template <typename T>
-	static void destroy(OOBase::AllocatorInstance& allocator, T*& p)
+	eType type() const
 	{
-		if (p)
-		{
-			p->~T();
-			allocator.free(p);
-			p = NULL;
-		}
+		return m_type;
 	}
 
-	virtual unsigned char next(unsigned char c, bool& again) = 0;
+	void reset(eType type)
+	{
+		m_type = type;
+		m_count = (type == UTF16BE ? 1 : 0);
+	}
 
-protected:
-	virtual ~Decoder() {};
-	Decoder() {}
+	// The decoder IOState::init will select for a document starting with p, and how many
+	// bytes it reads raw before selecting it. Returns None where the choice depends on
+	// more than the first few bytes.
+	static eType sniff(const unsigned char* p, size_t len, size_t& prefix);
+
+	// Sets again if c carries no character and the next byte is needed
+	template <eType T>
+	unsigned char next(unsigned char c, bool& again);
 
 private:
 	Decoder(const Decoder&);
 	Decoder& operator =(const Decoder&);
 
-	template <typename T>
-	static T* create_i(OOBase::AllocatorInstance& allocator)
-	{
-		void* p = allocator.allocate(sizeof(T),OOBase::alignment_of<T>::value);
-		if (!p)
-			throw "Out of memory";
+	static const unsigned char s_ebcdic[256];
 
-		return ::new (p) T();
-	}
+	eType        m_type;
+	unsigned int m_count;
 };
 
+template <>
+inline unsigned char Decoder::next<Decoder::None>(unsigned char c, bool& again)
+{
+	again = false;
+	return c;
+}
+
+template <>
+inline unsigned char Decoder::next<Decoder::UTF32LE>(unsigned char c, bool& again)
+{
+	again = (m_count++ != 0);
+
+	if (m_count >= 4)
+		m_count = 0;
+
+	if (again && c != '\0')
+		again = false;
+
+	return c;
+}
+
+template <>
+inline unsigned char Decoder::next<Decoder::UTF32BE>(unsigned char c, bool& again)
+{
+	again = (m_count++ != 3);
+
+	if (m_count >= 4)
+		m_count = 0;
+
+	if (again && c != '\0')
+		again = false;
+
+	return c;
+}
+
+template <>
+inline unsigned char Decoder::next<Decoder::UTF16LE>(unsigned char c, bool& again)
+{
+	again = (m_count != 0);
+	m_count ^= 1;
+
+	if (again && c != '\0')
+		again = false;
+
+	return c;
+}
+
+template <>
+inline unsigned char Decoder::next<Decoder::UTF16BE>(unsigned char c, bool& again)
+{
+	again = (m_count != 0);
+	m_count ^= 1;
+
+	if (again && c != '\0')
+		again = false;
+
+	return c;
+}
+
+template <>
+inline unsigned char Decoder::next<Decoder::EBCDIC>(unsigned char c, bool& again)
+{
+	again = false;
+	return s_ebcdic[c];
+}
 
 #endif /* DECODER_H_INCLUDED_ */
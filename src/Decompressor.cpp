@@ -0,0 +1,251 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "Decompressor.h"
+
+#include <string.h>
+
+Decompressor* Decompressor::create(OOBase::AllocatorInstance& allocator, BlockSource& input)
+{
+	void* p = allocator.allocate(sizeof(Decompressor),OOBase::alignment_of<Decompressor>::value);
+	if (!p)
+		return NULL;
+
+	return ::new (p) Decompressor(allocator,input);
+}
+
+void Decompressor::destroy()
+{
+	OOBase::AllocatorInstance& a = m_allocator;
+	this->~Decompressor();
+	a.free(this);
+}
+
+Decompressor::Decompressor(OOBase::AllocatorInstance& allocator, BlockSource& input) :
+		m_allocator(allocator),
+		m_input(input),
+		m_format(Unknown),
+		m_end(false),
+		m_complete(false),
+		m_out(NULL)
+#if defined(HAVE_ZLIB)
+		, m_zlib_init(false)
+#endif
+#if defined(HAVE_ZSTD)
+		, m_zstd(NULL)
+#endif
+{
+#if defined(HAVE_ZLIB)
+	memset(&m_zlib,0,sizeof(m_zlib));
+#endif
+#if defined(HAVE_ZSTD)
+	memset(&m_zstd_in,0,sizeof(m_zstd_in));
+#endif
+}
+
+Decompressor::~Decompressor()
+{
+#if defined(HAVE_ZLIB)
+	if (m_zlib_init)
+		inflateEnd(&m_zlib);
+#endif
+#if defined(HAVE_ZSTD)
+	if (m_zstd)
+		ZSTD_freeDStream(m_zstd);
+#endif
+
+	m_allocator.free(m_out);
+}
+
+const unsigned char* Decompressor::refill(size_t& len)
+{
+	len = 0;
+	const unsigned char* p = NULL;
+	if (!m_end)
+	{
+		p = m_input.next(len);
+		if (!len)
+			m_end = true;
+	}
+	return p;
+}
+
+const unsigned char* Decompressor::sniff(size_t& len)
+{
+	const unsigned char* p = refill(len);
+
+	m_format = Plain;
+	if (len >= 4)
+	{
+		if (p[0] == 0x1F && p[1] == 0x8B)
+			m_format = GZip;
+		else if (p[0] == 0x28 && p[1] == 0xB5 && p[2] == 0x2F && p[3] == 0xFD)
+			m_format = ZStd;
+	}
+
+	if (m_format == Plain)
+		return p;
+
+	m_out = static_cast<unsigned char*>(m_allocator.allocate(block_size,16));
+	if (!m_out)
+		throw "Out of memory";
+
+	if (m_format == GZip)
+	{
+#if defined(HAVE_ZLIB)
+		// 16 + MAX_WBITS reads a gzip header
+		if (inflateInit2(&m_zlib,16 + MAX_WBITS) != Z_OK)
+			throw "Out of memory";
+		m_zlib_init = true;
+
+		m_zlib.next_in = const_cast<Bytef*>(p);
+		m_zlib.avail_in = static_cast<uInt>(len);
+		return inflate_block(len);
+#else
+		throw "gzip input is not supported, configure --with-zlib";
+#endif
+	}
+	else
+	{
+#if defined(HAVE_ZSTD)
+		m_zstd = ZSTD_createDStream();
+		if (!m_zstd)
+			throw "Out of memory";
+		ZSTD_initDStream(m_zstd);
+
+		m_zstd_in.src = p;
+		m_zstd_in.size = len;
+		m_zstd_in.pos = 0;
+		return zstd_block(len);
+#else
+		throw "zstd input is not supported, configure --with-zstd";
+#endif
+	}
+}
+
+const unsigned char* Decompressor::next(size_t& len)
+{
+	switch (m_format)
+	{
+	case Unknown:
+		return sniff(len);
+
+#if defined(HAVE_ZLIB)
+	case GZip:
+		return inflate_block(len);
+#endif
+
+#if defined(HAVE_ZSTD)
+	case ZStd:
+		return zstd_block(len);
+#endif
+
+	case Plain:
+	default:
+		return refill(len);
+	}
+}
+
+#if defined(HAVE_ZLIB)
+const unsigned char* Decompressor::inflate_block(size_t& len)
+{
+	m_zlib.next_out = m_out;
+	m_zlib.avail_out = static_cast<uInt>(block_size);
+
+	while (m_zlib.avail_out)
+	{
+		// Anything left over starts another gzip member
+		if (m_zlib.avail_in)
+			m_complete = false;
+
+		int err = inflate(&m_zlib,Z_NO_FLUSH);
+		if (err == Z_STREAM_END)
+		{
+			m_complete = true;
+			inflateReset(&m_zlib);
+		}
+		else if (err != Z_OK && err != Z_BUF_ERROR)
+			throw "Corrupt gzip input";
+
+		// Everything has been flushed that can be, more input is needed
+		if (m_zlib.avail_in == 0 && m_zlib.avail_out)
+		{
+			size_t n = 0;
+			const unsigned char* p = refill(n);
+			if (!n)
+			{
+				if (!m_complete)
+					throw "Truncated gzip input";
+				break;
+			}
+
+			m_zlib.next_in = const_cast<Bytef*>(p);
+			m_zlib.avail_in = static_cast<uInt>(n);
+		}
+	}
+
+	len = block_size - m_zlib.avail_out;
+	return (len ? m_out : NULL);
+}
+#endif
+
+#if defined(HAVE_ZSTD)
+const unsigned char* Decompressor::zstd_block(size_t& len)
+{
+	ZSTD_outBuffer out = { m_out, block_size, 0 };
+
+	while (out.pos < out.size)
+	{
+		size_t in_pos = m_zstd_in.pos;
+		size_t out_pos = out.pos;
+		size_t r = ZSTD_decompressStream(m_zstd,&out,&m_zstd_in);
+		if (ZSTD_isError(r))
+			throw "Corrupt zstd input";
+
+		// 0 is the end of a frame, more frames may follow.
+		// With no input and nothing to flush, r only asks for the next frame.
+		if (r == 0)
+			m_complete = true;
+		else if (m_zstd_in.pos != in_pos || out.pos != out_pos)
+			m_complete = false;
+
+		// Everything has been flushed that can be, more input is needed
+		if (m_zstd_in.pos == m_zstd_in.size && out.pos < out.size)
+		{
+			size_t n = 0;
+			const unsigned char* p = refill(n);
+			if (!n)
+			{
+				if (!m_complete)
+					throw "Truncated zstd input";
+				break;
+			}
+
+			m_zstd_in.src = p;
+			m_zstd_in.size = n;
+			m_zstd_in.pos = 0;
+		}
+	}
+
+	len = out.pos;
+	return (len ? m_out : NULL);
+}
+#endif
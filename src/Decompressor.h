@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DECOMPRESSOR_H_INCLUDED_
+#define DECOMPRESSOR_H_INCLUDED_
+
+#include <OOBase/Memory.h>
+
+#include "IO.h"
+
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+// Recognises gzip and zstd input by its magic bytes and decompresses it a block at a
+// time, uncompressed input passes straight through.
+// gzip needs HAVE_ZLIB (configure --with-zlib), zstd needs HAVE_ZSTD (configure --with-zstd)
+class Decompressor : public BlockSource
+{
+public:
+	static const size_t block_size = 128 * 1024;
+
+	// The input is not owned, and must outlive the Decompressor. Returns NULL if out of memory
+	static Decompressor* create(OOBase::AllocatorInstance& allocator, BlockSource& input);
+	void destroy();
+
+	virtual const unsigned char* next(size_t& len);
+
+private:
+	Decompressor(OOBase::AllocatorInstance& allocator, BlockSource& input);
+	virtual ~Decompressor();
+
+	enum Format
+	{
+		Unknown = 0,
+		Plain,
+		GZip,
+		ZStd
+	};
+
+	OOBase::AllocatorInstance& m_allocator;
+	BlockSource&               m_input;
+	int                        m_format;
+	bool                       m_end;        // The input is exhausted
+	bool                       m_complete;   // The last compressed stream was complete
+	unsigned char*             m_out;
+
+#if defined(HAVE_ZLIB)
+	z_stream m_zlib;
+	bool     m_zlib_init;
+
+	const unsigned char* inflate_block(size_t& len);
+#endif
+
+#if defined(HAVE_ZSTD)
+	ZSTD_DStream*  m_zstd;
+	ZSTD_inBuffer  m_zstd_in;
+
+	const unsigned char* zstd_block(size_t& len);
+#endif
+
+	const unsigned char* sniff(size_t& len);
+	const unsigned char* refill(size_t& len);
+};
+
+#endif // DECOMPRESSOR_H_INCLUDED_
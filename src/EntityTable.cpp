@@ -0,0 +1,222 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "EntityTable.h"
+
+#include <errno.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+EntityTable::EntityTable(OOBase::AllocatorInstance& allocator) :
+		m_allocator(allocator),
+		m_refcount(1),
+		m_parent(NULL),
+		m_int_gen(allocator),
+		m_ext_gen(allocator),
+		m_int_param(allocator),
+		m_ext_param(allocator)
+{
+}
+
+EntityTable::~EntityTable()
+{
+	if (m_parent)
+		m_parent->release();
+}
+
+EntityTable* EntityTable::addref()
+{
+#if defined(_MSC_VER)
+	_InterlockedIncrement(&m_refcount);
+#else
+	__atomic_add_fetch(&m_refcount,1,__ATOMIC_RELAXED);
+#endif
+	return this;
+}
+
+void EntityTable::release()
+{
+#if defined(_MSC_VER)
+	long r = _InterlockedDecrement(&m_refcount);
+#else
+	long r = __atomic_sub_fetch(&m_refcount,1,__ATOMIC_ACQ_REL);
+#endif
+	if (r == 0)
+	{
+		OOBase::AllocatorInstance& a = m_allocator;
+		this->~EntityTable();
+		a.free(this);
+	}
+}
+
+void EntityTable::reset(EntityTable* parent)
+{
+	// Keep the capacity for the next document
+	m_int_gen.clear();
+	m_ext_gen.clear();
+	m_int_param.clear();
+	m_ext_param.clear();
+
+	if (parent != m_parent)
+	{
+		if (parent)
+			parent->addref();
+		if (m_parent)
+			m_parent->release();
+		m_parent = parent;
+	}
+}
+
+int EntityTable::add_internal_general(const OOBase::LocalString& strName, const OOBase::LocalString& strValue, bool extern_decl)
+{
+	if (m_ext_gen.find(strName) != m_ext_gen.end())
+		return EEXIST;
+
+	return m_int_gen.insert(strName,InternalEntity(strValue,extern_decl));
+}
+
+int EntityTable::add_external_general(const OOBase::LocalString& strName, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId, const OOBase::LocalString& strNData)
+{
+	if (m_int_gen.find(strName) != m_int_gen.end())
+		return EEXIST;
+
+	return m_ext_gen.insert(strName,ExternalEntity(strPublicId,strSystemId,strNData));
+}
+
+int EntityTable::add_internal_param(const OOBase::LocalString& strName, const OOBase::LocalString& strValue)
+{
+	if (m_ext_param.find(strName) != m_ext_param.end())
+		return EEXIST;
+
+	return m_int_param.insert(strName,strValue);
+}
+
+int EntityTable::add_external_param(const OOBase::LocalString& strName, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId)
+{
+	if (m_int_param.find(strName) != m_int_param.end())
+		return EEXIST;
+
+	return m_ext_param.insert(strName,ExternalEntity(strPublicId,strSystemId));
+}
+
+bool EntityTable::find_general(const OOBase::LocalString& strName, InternalEntity*& internal, ExternalEntity*& external)
+{
+	internal = NULL;
+	external = NULL;
+
+	// The nearest table declaring the name wins, whichever kind it declares
+	for (EntityTable* t = this;t != NULL;t = t->m_parent)
+	{
+		OOBase::HashTable<OOBase::LocalString,InternalEntity,OOBase::AllocatorInstance>::iterator i = t->m_int_gen.find(strName);
+		if (i != t->m_int_gen.end())
+		{
+			internal = &i->value;
+			return true;
+		}
+
+		OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance>::iterator j = t->m_ext_gen.find(strName);
+		if (j != t->m_ext_gen.end())
+		{
+			external = &j->value;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool EntityTable::find_param(const OOBase::LocalString& strName, OOBase::LocalString*& internal, ExternalEntity*& external)
+{
+	internal = NULL;
+	external = NULL;
+
+	for (EntityTable* t = this;t != NULL;t = t->m_parent)
+	{
+		OOBase::HashTable<OOBase::LocalString,OOBase::LocalString,OOBase::AllocatorInstance>::iterator i = t->m_int_param.find(strName);
+		if (i != t->m_int_param.end())
+		{
+			internal = &i->value;
+			return true;
+		}
+
+		OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance>::iterator j = t->m_ext_param.find(strName);
+		if (j != t->m_ext_param.end())
+		{
+			external = &j->value;
+			return true;
+		}
+	}
+	return false;
+}
+
+OOBase::LocalString EntityTable::copy(const OOBase::LocalString& str) const
+{
+	OOBase::LocalString strCopy(m_allocator);
+	if (strCopy.assign(str.c_str(),str.length()) != 0)
+		throw "Out of memory";
+	return strCopy;
+}
+
+EntityTable* EntityTable::share(OOBase::AllocatorInstance& allocator)
+{
+	void* p = allocator.allocate(sizeof(EntityTable),OOBase::alignment_of<EntityTable>::value);
+	if (!p)
+		throw "Out of memory";
+
+	EntityTable* t = ::new (p) EntityTable(allocator);
+	try
+	{
+		t->reset(m_parent);
+
+		// Every string is copied, nothing may refer to this table's allocator
+		for (OOBase::HashTable<OOBase::LocalString,InternalEntity,OOBase::AllocatorInstance>::iterator i = m_int_gen.begin();i != m_int_gen.end();++i)
+		{
+			if (t->add_internal_general(t->copy(i->key),t->copy(i->value.m_strValue),i->value.m_extern_decl) != 0)
+				throw "Out of memory";
+		}
+
+		for (OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance>::iterator i = m_ext_gen.begin();i != m_ext_gen.end();++i)
+		{
+			if (t->add_external_general(t->copy(i->key),t->copy(i->value.m_strPublicId),t->copy(i->value.m_strSystemId),t->copy(i->value.m_strNData)) != 0)
+				throw "Out of memory";
+		}
+
+		for (OOBase::HashTable<OOBase::LocalString,OOBase::LocalString,OOBase::AllocatorInstance>::iterator i = m_int_param.begin();i != m_int_param.end();++i)
+		{
+			if (t->add_internal_param(t->copy(i->key),t->copy(i->value)) != 0)
+				throw "Out of memory";
+		}
+
+		for (OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance>::iterator i = m_ext_param.begin();i != m_ext_param.end();++i)
+		{
+			if (t->add_external_param(t->copy(i->key),t->copy(i->value.m_strPublicId),t->copy(i->value.m_strSystemId)) != 0)
+				throw "Out of memory";
+		}
+	}
+	catch (const char*)
+	{
+		t->release();
+		throw;
+	}
+
+	return t;
+}
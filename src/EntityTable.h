@@ -0,0 +1,102 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ENTITYTABLE_H_INCLUDED_
+#define ENTITYTABLE_H_INCLUDED_
+
+#include <OOBase/String.h>
+#include <OOBase/HashTable.h>
+
+// Entity declarations by name. A name not found is looked for in the parent, so a
+// document's own declarations overlay a shared table, as if the shared declarations
+// followed them like a common external subset. A name declared at one level hides the
+// parent's declaration of it, whether internal or external.
+// Shared tables are reference counted and never modified, so any number of Tokenizers
+// on any number of threads may search them at once.
+class EntityTable
+{
+public:
+	struct InternalEntity
+	{
+		InternalEntity(const OOBase::LocalString& strValue, bool extern_decl) :
+			m_strValue(strValue), m_extern_decl(extern_decl)
+		{}
+
+		OOBase::LocalString m_strValue;
+		bool                m_extern_decl;
+	};
+
+	struct ExternalEntity
+	{
+		ExternalEntity(const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId, const OOBase::LocalString& strNData) :
+			m_strPublicId(strPublicId), m_strSystemId(strSystemId), m_strNData(strNData)
+		{}
+
+		ExternalEntity(const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId) :
+			m_strPublicId(strPublicId), m_strSystemId(strSystemId), m_strNData(strSystemId.get_allocator())
+		{}
+
+		OOBase::LocalString m_strPublicId;
+		OOBase::LocalString m_strSystemId;
+		OOBase::LocalString m_strNData;
+	};
+
+	EntityTable(OOBase::AllocatorInstance& allocator);
+	~EntityTable();
+
+	EntityTable* addref();
+	void release();
+
+	// Empties the table, and searches parent next, which may be NULL
+	void reset(EntityTable* parent);
+
+	// Return EEXIST if the name is already declared in this table, internal or external,
+	// the first declaration binds
+	int add_internal_general(const OOBase::LocalString& strName, const OOBase::LocalString& strValue, bool extern_decl);
+	int add_external_general(const OOBase::LocalString& strName, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId, const OOBase::LocalString& strNData);
+	int add_internal_param(const OOBase::LocalString& strName, const OOBase::LocalString& strValue);
+	int add_external_param(const OOBase::LocalString& strName, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId);
+
+	// False if not declared here or in any parent, otherwise exactly one of the two is set
+	bool find_general(const OOBase::LocalString& strName, InternalEntity*& internal, ExternalEntity*& external);
+	bool find_param(const OOBase::LocalString& strName, OOBase::LocalString*& internal, ExternalEntity*& external);
+
+	// Copies this table's own declarations into a new shared table with the same parent.
+	// The allocator must be thread-safe if the copy is to be released on other threads.
+	EntityTable* share(OOBase::AllocatorInstance& allocator);
+
+private:
+	EntityTable(const EntityTable&);
+	EntityTable& operator = (const EntityTable&);
+
+	OOBase::AllocatorInstance& m_allocator;
+	volatile long              m_refcount;
+	EntityTable*               m_parent;
+
+	OOBase::HashTable<OOBase::LocalString,InternalEntity,OOBase::AllocatorInstance>      m_int_gen;
+	OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance>      m_ext_gen;
+	OOBase::HashTable<OOBase::LocalString,OOBase::LocalString,OOBase::AllocatorInstance> m_int_param;
+	OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance>      m_ext_param;
+
+	OOBase::LocalString copy(const OOBase::LocalString& str) const;
+};
+
+#endif // ENTITYTABLE_H_INCLUDED_
@@ -20,28 +20,68 @@
 ///////////////////////////////////////////////////////////////////////////////////
 
 #include "IO.h"
+#include "ReadAhead.h"
+#include "Decompressor.h"
 
 #include <errno.h>
 
-IO::IO() : m_f(NULL), m_eof(true)
+IO::IO(OOBase::AllocatorInstance& allocator, bool read_ahead) :
+		m_allocator(allocator),
+		m_reader(NULL),
+		m_decompressor(NULL),
+		m_source(NULL),
+		m_eof(true),
+		m_read_ahead(read_ahead),
+		m_start(NULL),
+		m_ptr(NULL),
+		m_end(NULL),
+		m_consumed(0)
 { }
 
 IO::~IO()
 {
-	if (m_f)
-		fclose(m_f);
+	if (m_decompressor)
+		m_decompressor->destroy();
+
+	if (m_reader)
+		m_reader->destroy();
 }
 
 int IO::open(const char* fname)
 {
 	int err = 0;
-	m_f = fopen(fname,"rb");
-	if (m_f)
-		m_eof = (feof(m_f) != 0);
-	else
-		err = errno;
+	m_reader = ReadAhead::create(m_allocator,fname,err,m_read_ahead);
+	if (!m_reader)
+		return err;
+
+	// Compressed files are recognised by their first block
+	m_decompressor = Decompressor::create(m_allocator,*m_reader);
+	if (!m_decompressor)
+		return ENOMEM;
+
+	m_source = m_decompressor;
+	m_eof = false;
+
+	return 0;
+}
+
+int IO::open(const unsigned char* buffer, size_t len)
+{
+	// The buffer is not copied, it must outlive this IO
+	m_start = buffer;
+	m_ptr = buffer;
+	m_end = buffer + len;
+	m_eof = false;
+
+	return 0;
+}
+
+int IO::open(BlockSource& source)
+{
+	m_source = &source;
+	m_eof = false;
 
-	return err;
+	return 0;
 }
 
 bool IO::is_eof() const
@@ -49,16 +89,42 @@ bool IO::is_eof() const
 	return m_eof;
 }
 
-unsigned char IO::get_char()
+unsigned char IO::next_block()
 {
-	unsigned char c = '\0';
-	if (m_f)
+	m_consumed += m_end - m_start;
+
+	size_t len = 0;
+	if (m_source)
+		m_ptr = m_source->next(len);
+
+	if (!len)
 	{
-		size_t r = fread(&c,sizeof(c),1,m_f);
-		if (r == 0)
-			m_eof = true;
-		else if (r == (size_t)-1)
-			throw "IO Error";
+		m_start = m_ptr = m_end = NULL;
+		m_eof = true;
+		return '\0';
 	}
-	return c;
+
+	m_start = m_ptr;
+	m_end = m_ptr + len;
+	return *m_ptr++;
+}
+
+const unsigned char* IO::peek(size_t& len)
+{
+	len = 0;
+	if (m_ptr == m_end)
+	{
+		if (m_eof)
+			return NULL;
+
+		// next_block() hands out the first byte, so take it back
+		next_block();
+		if (m_eof)
+			return NULL;
+
+		--m_ptr;
+	}
+
+	len = m_end - m_ptr;
+	return m_ptr;
 }
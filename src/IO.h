@@ -26,22 +26,96 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <OOBase/Memory.h>
+
+#include "Decoder.h"
+
+class ReadAhead;
+class Decompressor;
+
+// Supplies an IO with blocks of input, see ReadAhead and Pipeline
+class BlockSource
+{
+public:
+	// The next block, valid until the following call. len is 0 at the end.
+	virtual const unsigned char* next(size_t& len) = 0;
+
+	// The encoding the blocks have already been decoded from, see IOState::set_decoder
+	virtual Decoder::eType decoded() const
+	{
+		return Decoder::None;
+	}
+
+protected:
+	BlockSource() {}
+	virtual ~BlockSource() {}
+
+private:
+	BlockSource(const BlockSource&);
+	BlockSource& operator = (const BlockSource&);
+};
+
 class IO
 {
 public:
-	IO();
+	// Without read_ahead, files are read on the calling thread, see ReadAhead
+	IO(OOBase::AllocatorInstance& allocator, bool read_ahead = true);
 	~IO();
 
 	int open(const char* fname);
-	unsigned char get_char();
+	int open(const unsigned char* buffer, size_t len);
+
+	// The source is not owned, and must outlive this IO
+	int open(BlockSource& source);
+
 	bool is_eof() const;
 
+	Decoder::eType decoded() const
+	{
+		return (m_source ? m_source->decoded() : Decoder::None);
+	}
+
+	unsigned char get_char()
+	{
+		// Files and memory are both read a block at a time
+		if (m_ptr != m_end)
+			return *m_ptr++;
+
+		return next_block();
+	}
+
+	// Bulk access to the unread part of the current block, moving on to the
+	// next block if it is used up. Returns NULL at the end of the input
+	const unsigned char* peek(size_t& len);
+
+	void skip(size_t len)
+	{
+		m_ptr += len;
+	}
+
+	// Bytes handed out so far, after decompression
+	unsigned long long offset() const
+	{
+		return m_consumed + (m_ptr - m_start);
+	}
+
 private:
 	IO(const IO&);
 	IO& operator = (const IO&);
 
-	FILE* m_f;
-	bool m_eof;
+	OOBase::AllocatorInstance& m_allocator;
+	ReadAhead*                 m_reader;
+	Decompressor*              m_decompressor;
+	BlockSource*               m_source;
+	bool                       m_eof;
+	bool                       m_read_ahead;
+
+	const unsigned char* m_start;
+	const unsigned char* m_ptr;
+	const unsigned char* m_end;
+	unsigned long long   m_consumed;  // Bytes of the blocks before m_start
+
+	unsigned char next_block();
 };
 
 #endif /* IO_H_ */
@@ -20,18 +20,30 @@
 ///////////////////////////////////////////////////////////////////////////////////
 
 #include "IOState.h"
+#include "Resolver.h"
+#include "ProfilingAllocator.h"
 
-IOState* IOState::create(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& fname, unsigned int version)
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+IOState* IOState::create(OOBase::AllocatorInstance& allocator, Resolver& resolver, const OOBase::LocalString& fname, unsigned int version, bool read_ahead)
 {
+	OOXML_ALLOC_SCOPE(IOState);
+
 	void* p = allocator.allocate(sizeof(IOState),OOBase::alignment_of<IOState>::value);
 	if (!p)
 		throw "Out of memory";
 
-	return ::new (p) IOState(allocator,fname,version);
+	return ::new (p) IOState(allocator,resolver,fname,version,read_ahead);
 }
 
 IOState* IOState::create(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& entity_name, unsigned int version, const OOBase::LocalString& repl_text)
 {
+	OOXML_ALLOC_SCOPE(IOState);
+
 	void* p = allocator.allocate(sizeof(IOState),OOBase::alignment_of<IOState>::value);
 	if (!p)
 		throw "Out of memory";
@@ -46,7 +58,7 @@ void IOState::destroy()
 	a.free(this);
 }
 
-IOState::IOState(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& fname, unsigned int version) :
+IOState::IOState(OOBase::AllocatorInstance& allocator, Resolver& resolver, const OOBase::LocalString& fname, unsigned int version, bool read_ahead) :
 		m_fname(fname),
 		m_col(0),
 		m_line(1),
@@ -55,21 +67,25 @@ IOState::IOState(OOBase::AllocatorInstance& allocator, const OOBase::LocalString
 		m_cs(0),
 		m_char('\0'),
 		m_allocator(allocator),
-		m_decoder(NULL),
-		m_decoder_type(Decoder::None),
+		m_decoder(),
+		m_read_type(Decoder::None),
 		m_io(NULL),
 		m_eof(false),
 		m_preinit(true),
 		m_input(allocator),
-		m_version(version)
+		m_version(version),
+		m_decoded(NULL),
+		m_decoded_ptr(NULL),
+		m_decoded_end(NULL),
+		m_text(allocator)
 {
 	void* p = allocator.allocate(sizeof(IO),OOBase::alignment_of<IO>::value);
 	if (!p)
 		throw "Out of memory";
 
-	m_io = new (p) IO();
+	m_io = new (p) IO(allocator,read_ahead);
 
-	int err = m_io->open(fname.c_str());
+	int err = resolver.open(*m_io,fname);
 	if (err != 0)
 		throw "IO Error";
 }
@@ -83,20 +99,24 @@ IOState::IOState(OOBase::AllocatorInstance& allocator, const OOBase::LocalString
 		m_cs(0),
 		m_char('\0'),
 		m_allocator(allocator),
-		m_decoder(NULL),
-		m_decoder_type(Decoder::None),
+		m_decoder(),
+		m_read_type(Decoder::None),
 		m_io(NULL),
 		m_eof(repl_text.empty()),
 		m_preinit(true),
 		m_input(allocator),
-		m_version(version)
+		m_version(version),
+		m_decoded(NULL),
+		m_decoded_ptr(NULL),
+		m_decoded_end(NULL),
+		m_text(repl_text)
 {
-	m_input.rappend(repl_text);
+	m_input.insert(m_text.c_str(),m_text.length());
 }
 
 IOState::~IOState()
 {
-	Decoder::destroy(m_allocator,m_decoder);
+	m_allocator.free(m_decoded);
 
 	if (m_io)
 	{
@@ -122,17 +142,16 @@ void IOState::init()
 
 void IOState::set_decoder(Decoder::eType type)
 {
-	if (m_decoder_type != type)
-	{
-		Decoder::destroy(m_allocator,m_decoder);
-		m_decoder = Decoder::create(m_allocator,type);
-		m_decoder_type = type;
-	}
+	if (m_decoder.type() != type)
+		m_decoder.reset(type);
+
+	// A Pipeline's reader thread may have decoded the rest of the stream already
+	m_read_type = (m_io && m_io->decoded() == type ? Decoder::None : type);
 }
 
 void IOState::set_encoding(Token& token, OOBase::LocalString& str)
 {
-	str = token.pop_string();
+	token.pop_string(str);
 }
 
 void IOState::switch_encoding(OOBase::LocalString& strEncoding)
@@ -140,7 +159,7 @@ void IOState::switch_encoding(OOBase::LocalString& strEncoding)
 	if (strEncoding.empty())
 	{
 		const char* sz = "UTF-8";
-		switch (m_decoder_type)
+		switch (m_decoder.type())
 		{
 		case Decoder::UTF16BE:
 			sz = "UTF-16BE";
@@ -163,9 +182,6 @@ void IOState::switch_encoding(OOBase::LocalString& strEncoding)
 		if (err != 0)
 			throw "Out of memory";
 	}
-
-	if (strEncoding != "UTF-8" && strEncoding != "utf-8" && strEncoding != "UTF8" && strEncoding != "utf8")
-		printf("NO DECODER FOR %s - WILL FAIL! ",strEncoding.c_str());
 }
 
 unsigned char IOState::get_char(bool& from_input)
@@ -179,17 +195,20 @@ unsigned char IOState::get_char(bool& from_input)
 	else if (m_io)
 	{
 		from_input = false;
-		bool again = false;
-		do
+
+		if (m_read_type == Decoder::None)
 		{
+			// UTF-8 is read straight from the IO's block
 			c = m_io->get_char();
-
-			if (m_decoder)
-				c = m_decoder->next(c,again);
+			m_eof = m_io->is_eof();
+		}
+		else if (m_decoded_ptr != m_decoded_end)
+			c = *m_decoded_ptr++;
+		else
+		{
+			c = (m_preinit ? decode_char() : decode());
+			m_eof = m_io->is_eof();
 		}
-		while(again);
-
-		m_eof = m_io->is_eof();
 	}
 	else
 		m_eof = true;
@@ -197,6 +216,78 @@ unsigned char IOState::get_char(bool& from_input)
 	return c;
 }
 
+unsigned char IOState::decode_char()
+{
+	// The declaration may still change the decoder, so one character at a time
+	switch (m_read_type)
+	{
+	case Decoder::UTF32LE:
+		return read_char<Decoder::UTF32LE>();
+
+	case Decoder::UTF32BE:
+		return read_char<Decoder::UTF32BE>();
+
+	case Decoder::UTF16LE:
+		return read_char<Decoder::UTF16LE>();
+
+	case Decoder::UTF16BE:
+		return read_char<Decoder::UTF16BE>();
+
+	case Decoder::EBCDIC:
+		return read_char<Decoder::EBCDIC>();
+
+	case Decoder::None:
+	default:
+		return m_io->get_char();
+	}
+}
+
+unsigned char IOState::decode()
+{
+	OOXML_ALLOC_SCOPE(IOState);
+
+	if (!m_decoded)
+	{
+		m_decoded = static_cast<unsigned char*>(m_allocator.allocate(decode_size,16));
+		if (!m_decoded)
+			throw "Out of memory";
+	}
+
+	// Switch once per block, so each decoder runs its own inlined loop.
+	// A block may end part way through a character, so go on until one is complete
+	while (m_decoded_ptr == m_decoded_end && !m_io->is_eof())
+	{
+		switch (m_read_type)
+		{
+		case Decoder::UTF32LE:
+			decode_block<Decoder::UTF32LE>();
+			break;
+
+		case Decoder::UTF32BE:
+			decode_block<Decoder::UTF32BE>();
+			break;
+
+		case Decoder::UTF16LE:
+			decode_block<Decoder::UTF16LE>();
+			break;
+
+		case Decoder::UTF16BE:
+			decode_block<Decoder::UTF16BE>();
+			break;
+
+		case Decoder::EBCDIC:
+		default:
+			decode_block<Decoder::EBCDIC>();
+			break;
+		}
+	}
+
+	if (m_decoded_ptr == m_decoded_end)
+		return '\0';
+
+	return *m_decoded_ptr++;
+}
+
 bool IOState::is_file() const
 {
 	return (m_io != NULL);
@@ -209,7 +300,33 @@ unsigned int IOState::get_version()
 
 void IOState::push(unsigned char c)
 {
-	m_input.push(c);
+	m_input.inject(c);
+}
+
+unsigned long long IOState::get_offset() const
+{
+	if (!m_io)
+		return 0;
+
+	// Bytes ungot, and decoded but not yet read, are only ever whole characters
+	return m_io->offset() - (m_input.ahead() + (m_decoded_end - m_decoded_ptr)) * char_width();
+}
+
+unsigned int IOState::char_width() const
+{
+	switch (m_read_type)
+	{
+	case Decoder::UTF16LE:
+	case Decoder::UTF16BE:
+		return 2;
+
+	case Decoder::UTF32LE:
+	case Decoder::UTF32BE:
+		return 4;
+
+	default:
+		return 1;
+	}
 }
 
 unsigned char IOState::next_char()
@@ -229,12 +346,12 @@ unsigned char IOState::next_char()
 				unsigned char n2 = get_char(from_input);
 				if (n2 != 0x85)
 				{
-					m_input.push(n2);
-					m_input.push(n);
+					m_input.unget(n2);
+					m_input.unget(n);
 				}
 			}
 			else if (n != '\n')
-				m_input.push(n);
+				m_input.unget(n);
 		}
 		else if (!m_preinit && m_version == 1)
 		{
@@ -242,7 +359,7 @@ unsigned char IOState::next_char()
 			{
 				unsigned char n = get_char(from_input);
 				if (n != 0x85)
-					m_input.push(n);
+					m_input.unget(n);
 				else
 					c = '\n';
 			}
@@ -251,14 +368,14 @@ unsigned char IOState::next_char()
 				// e2 80 a8 = U+2028
 				unsigned char n = get_char(from_input);
 				if (n != 0x80)
-					m_input.push(n);
+					m_input.unget(n);
 				else
 				{
 					unsigned char n2 = get_char(from_input);
 					if (n2 != 0xA8)
 					{
-						m_input.push(n2);
-						m_input.push(n);
+						m_input.unget(n2);
+						m_input.unget(n);
 					}
 					else
 						c = '\n';
@@ -279,9 +396,298 @@ unsigned char IOState::next_char()
 	return c;
 }
 
-void IOState::rappend(const OOBase::LocalString& str)
+size_t IOState::read_run(const bool* plain, Token* token, unsigned char& last)
+{
+	// Pushed back input and the declaration need next_char()
+	if (!m_io || m_preinit || !m_input.empty())
+		return 0;
+
+	size_t len = 0;
+	const unsigned char* p = NULL;
+	if (m_read_type == Decoder::None)
+		p = m_io->peek(len);
+	else
+	{
+		p = m_decoded_ptr;
+		len = m_decoded_end - m_decoded_ptr;
+	}
+
+	size_t n = 0;
+	for (;n < len && plain[p[n]];++n)
+	{
+		if (p[n] == '\n')
+		{
+			++m_line;
+			m_col = 0;
+		}
+		++m_col;
+	}
+
+	if (n)
+	{
+		if (token)
+			token->append(p,n);
+
+		last = p[n - 1];
+		if (m_read_type == Decoder::None)
+			m_io->skip(n);
+		else
+			m_decoded_ptr += n;
+	}
+
+	return n;
+}
+
+namespace
+{
+	// Counts the LFs in [p,end), and sets last to the final one
+	size_t count_lf(const unsigned char* p, const unsigned char* end, const unsigned char*& last)
+	{
+		size_t count = 0;
+
+#if defined(__SSE2__)
+		const __m128i lf = _mm_set1_epi8('\n');
+		for (;end - p >= 16;p += 16)
+		{
+			unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)),lf)));
+			if (mask)
+			{
+				for (last = p + 15;*last != '\n';)
+					--last;
+
+				for (;mask;mask &= mask - 1)
+					++count;
+			}
+		}
+#endif
+
+		for (;p != end;++p)
+		{
+			if (*p == '\n')
+			{
+				last = p;
+				++count;
+			}
+		}
+
+		return count;
+	}
+
+	// Moves a position past [p,end) as next_char() would, a CR LF pair being one line end
+	void advance(const unsigned char* p, const unsigned char* end, size_t& line, size_t& col, bool& cr)
+	{
+		if (p != end && cr && *p == '\n')
+			++p;
+
+		cr = false;
+		if (p == end)
+			return;
+
+		if (memchr(p,'\r',end - p))
+		{
+			for (;p != end;++p)
+			{
+				if (cr && *p == '\n')
+				{
+					cr = false;
+					continue;
+				}
+
+				cr = (*p == '\r');
+				if (*p == '\n' || cr)
+				{
+					++line;
+					col = 0;
+				}
+
+				++col;
+			}
+			return;
+		}
+
+		const unsigned char* last = NULL;
+		size_t lines = count_lf(p,end,last);
+		if (lines)
+		{
+			line += lines;
+			col = end - last;
+		}
+		else
+			col += end - p;
+	}
+
+	enum ScanState
+	{
+		ScanText = 0,
+		ScanLt,           // After '<'
+		ScanTag,          // A start tag
+		ScanQuote,        // An attribute value
+		ScanEndTag,
+		ScanBang,         // After '<!'
+		ScanCommentOpen,  // After '<!-'
+		ScanComment,
+		ScanCData,
+		ScanDecl,
+		ScanPI
+	};
+}
+
+bool IOState::skip_content(unsigned char c)
 {
-	m_input.rappend(str);
+	// Decoded, XML 1.1 and pushed back input all need next_char()
+	if (!m_io || m_preinit || m_version == 1 || m_read_type != Decoder::None || !m_input.empty())
+		return false;
+
+	// Only markup changes the depth, so text is skipped with memchr, and
+	// line ends are counted 16 bytes at a time
+	ScanState state = (c == '<' ? ScanLt : ScanText);
+	size_t depth = 1;
+	size_t run = 0;
+	bool slash = false;
+	unsigned char quote = 0;
+	bool cr = false;
+
+	for (;;)
+	{
+		size_t len = 0;
+		const unsigned char* start = m_io->peek(len);
+		if (!start)
+		{
+			// Unclosed, the machine will report it
+			m_eof = true;
+			return true;
+		}
+
+		const unsigned char* end = start + len;
+		const unsigned char* p = start;
+		while (p != end)
+		{
+			if (state == ScanText)
+			{
+				const unsigned char* lt = static_cast<const unsigned char*>(memchr(p,'<',end - p));
+				if (!lt)
+				{
+					p = end;
+					break;
+				}
+
+				p = lt + 1;
+				state = ScanLt;
+				continue;
+			}
+
+			unsigned char b = *p;
+			switch (state)
+			{
+			case ScanLt:
+				if (b == '/' && depth == 1)
+				{
+					// The end tag: leave its '<' to be read next
+					if (p != start)
+						advance(start,p - 1,m_line,m_col,cr);
+					else
+					{
+						// Counted with the previous block, or as c
+						--m_col;
+					}
+
+					m_io->skip(p - start);
+					m_input.unget('<');
+					return true;
+				}
+
+				if (b == '/')
+					state = ScanEndTag;
+				else if (b == '!')
+					state = ScanBang;
+				else if (b == '?')
+				{
+					run = 0;
+					state = ScanPI;
+				}
+				else
+				{
+					// Look at the first byte of the name again as part of the tag
+					slash = false;
+					state = ScanTag;
+					continue;
+				}
+				break;
+
+			case ScanTag:
+				if (b == '"' || b == '\'')
+				{
+					quote = b;
+					state = ScanQuote;
+				}
+				else if (b == '>')
+				{
+					if (!slash)
+						++depth;
+					state = ScanText;
+				}
+				slash = (b == '/');
+				break;
+
+			case ScanQuote:
+				if (b == quote)
+					state = ScanTag;
+				break;
+
+			case ScanEndTag:
+				if (b == '>')
+				{
+					--depth;
+					state = ScanText;
+				}
+				break;
+
+			case ScanBang:
+				run = 0;
+				if (b == '-')
+					state = ScanCommentOpen;
+				else if (b == '[')
+					state = ScanCData;
+				else
+					state = ScanDecl;
+				break;
+
+			case ScanCommentOpen:
+				state = ScanComment;
+				break;
+
+			case ScanComment:
+			case ScanCData:
+				if (b == '>' && run >= 2)
+					state = ScanText;
+				else if (b == (state == ScanComment ? '-' : ']'))
+					++run;
+				else
+					run = 0;
+				break;
+
+			case ScanPI:
+				if (b == '>' && run)
+					state = ScanText;
+				else
+					run = (b == '?' ? 1 : 0);
+				break;
+
+			case ScanDecl:
+				if (b == '>')
+					state = ScanText;
+				break;
+
+			default:
+				break;
+			}
+
+			++p;
+		}
+
+		advance(start,end,m_line,m_col,cr);
+		m_io->skip(len);
+	}
 }
 
 bool IOState::is_eof() const
@@ -291,7 +697,7 @@ bool IOState::is_eof() const
 
 void IOState::set_version(Token& token)
 {
-	unsigned long version = strtoul(token.pop_string().c_str(),NULL,10);
+	unsigned long version = strtoul(token.pop_c_str(),NULL,10);
 
 	if (m_version == (unsigned int)-1)
 		m_version = version;
@@ -25,13 +25,16 @@
 #include <OOBase/Memory.h>
 
 #include "Token.h"
+#include "InputBuffer.h"
 #include "Decoder.h"
 #include "IO.h"
 
+class Resolver;
+
 class IOState
 {
 public:
-	static IOState* create(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& fname, unsigned int version = (unsigned int)-1);
+	static IOState* create(OOBase::AllocatorInstance& allocator, Resolver& resolver, const OOBase::LocalString& fname, unsigned int version = (unsigned int)-1, bool read_ahead = true);
 	static IOState* create(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& entity_name, unsigned int version, const OOBase::LocalString& repl_text);
 
 	void destroy();
@@ -41,11 +44,37 @@ public:
 
 	unsigned char next_char();
 	bool is_eof() const;
-	void rappend(const OOBase::LocalString& str);
 	void push(unsigned char c);
+
+	// Reads through the rest of an element's content, without checking it, up to the
+	// '<' of the end tag that closes it, which is left to be read next. c is the last
+	// character read, if it was the first of the content, or '\0'.
+	// Returns false, having read nothing, if the input cannot be scanned as raw UTF-8.
+	bool skip_content(unsigned char c);
+
+	// Reads on through the characters plain marks, as if by next_char(), appending them
+	// to token unless it is NULL. last is set to the final one read.
+	// Stops early at pushed back input or the end of a block, and returns the count read.
+	size_t read_run(const bool* plain, Token* token, unsigned char& last);
 	unsigned int get_version();
 	bool is_file() const;
 
+	// Bytes of the file up to the end of the last character read, after any decompression.
+	// Pushed-back and injected bytes are not counted again. If a Pipeline has decoded the
+	// input already, the bytes are those of the UTF-8.
+	unsigned long long get_offset() const;
+
+	// Bytes of the file in each ASCII character, such as '<'
+	unsigned int char_width() const;
+
+#if defined(OOXML_COUNTERS)
+	// Folded into the Tokenizer's Counters when popped
+	unsigned long long pushback_bytes() const
+	{
+		return m_input.pushback_bytes();
+	}
+#endif
+
 	OOBase::LocalString m_fname;
 	size_t              m_col;
 	size_t              m_line;
@@ -53,7 +82,7 @@ public:
 	bool                m_auto_pop;
 
 private:
-	IOState(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& fname, unsigned int version);
+	IOState(OOBase::AllocatorInstance& allocator, Resolver& resolver, const OOBase::LocalString& fname, unsigned int version, bool read_ahead);
 	IOState(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& entity_name, unsigned int version, const OOBase::LocalString& repl_text);
 
 	~IOState();
@@ -88,16 +117,69 @@ private:
 	void set_encoding(Token& token, OOBase::LocalString& str);
 	void init(bool entity, OOBase::LocalString& strEncoding, bool& standalone);
 	unsigned char get_char(bool& from_input);
+
+	template <Decoder::eType T>
+	unsigned char read_char()
+	{
+		bool again = false;
+		unsigned char c;
+		do
+		{
+			c = m_decoder.next<T>(m_io->get_char(),again);
+		}
+		while (again);
+
+		return c;
+	}
+
+	// Decodes the rest of the IO's current block into m_decoded
+	template <Decoder::eType T>
+	void decode_block()
+	{
+		size_t len = 0;
+		const unsigned char* p = m_io->peek(len);
+		if (!p)
+			return;
+
+		// Each character is at least one byte of input
+		if (len > decode_size)
+			len = decode_size;
+
+		unsigned char* out = m_decoded;
+		for (size_t i = 0;i < len;++i)
+		{
+			bool again = false;
+			unsigned char c = m_decoder.next<T>(p[i],again);
+			if (!again)
+				*out++ = c;
+		}
+
+		m_io->skip(len);
+		m_decoded_ptr = m_decoded;
+		m_decoded_end = out;
+	}
+
+	unsigned char decode_char();
+	unsigned char decode();
+
 	void switch_encoding(OOBase::LocalString& strEncoding);
 	void set_version(Token& token);
 
-	Decoder*       m_decoder;
-	Decoder::eType m_decoder_type;
+	Decoder        m_decoder;
+	Decoder::eType m_read_type;   // What get_char decodes, None if the IO has already decoded
 	IO*            m_io;
 	bool           m_eof;
 	bool           m_preinit;
-	Token          m_input;
+	InputBuffer    m_input;
 	unsigned int   m_version;
+
+	// Decoded a block at a time, once the declaration has been read
+	static const size_t decode_size = 4096;
+	unsigned char*       m_decoded;
+	const unsigned char* m_decoded_ptr;
+	const unsigned char* m_decoded_end;
+
+	OOBase::LocalString m_text;
 };
 
 #endif // IOSTATE_H_INCLUDED_
@@ -0,0 +1,174 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "InputBuffer.h"
+#include "ProfilingAllocator.h"
+
+#include <string.h>
+
+InputBuffer::InputBuffer(OOBase::AllocatorInstance& allocator) :
+		m_allocator(allocator),
+		m_top(0),
+		m_store(m_inline),
+		m_alloc(inline_size),
+		m_ahead(0),
+		m_injected(0)
+{
+	OOXML_COUNT(m_pushback_bytes = 0);
+}
+
+InputBuffer::~InputBuffer()
+{
+	if (m_store != m_inline)
+		m_allocator.free(m_store);
+}
+
+bool InputBuffer::top_is_store() const
+{
+	return (m_top && m_spans[m_top-1].m_pushback);
+}
+
+void InputBuffer::push_span(const unsigned char* ptr, const unsigned char* end, bool pushback)
+{
+	if (m_top == max_spans)
+		throw "Input stack overflow";
+
+	m_spans[m_top].m_ptr = ptr;
+	m_spans[m_top].m_end = end;
+	m_spans[m_top].m_pushback = pushback;
+	++m_top;
+}
+
+void InputBuffer::grow(size_t extra)
+{
+	OOXML_ALLOC_SCOPE(IOState);
+
+	const unsigned char* ptr = m_store + m_alloc;
+	if (top_is_store())
+		ptr = m_spans[m_top-1].m_ptr;
+
+	size_t len = (m_store + m_alloc) - ptr;
+	size_t new_alloc = m_alloc * 2;
+	if (new_alloc < len + extra)
+		new_alloc = len + extra;
+
+	unsigned char* new_store = static_cast<unsigned char*>(m_allocator.allocate(new_alloc,1));
+	if (!new_store)
+		throw "Out of memory";
+
+	// Keep the live bytes at the back of the new store
+	memcpy(new_store + new_alloc - len,ptr,len);
+
+	if (m_store != m_inline)
+		m_allocator.free(m_store);
+
+	m_store = new_store;
+	m_alloc = new_alloc;
+
+	if (top_is_store())
+	{
+		m_spans[m_top-1].m_ptr = new_store + new_alloc - len;
+		m_spans[m_top-1].m_end = new_store + new_alloc;
+	}
+}
+
+void InputBuffer::unget(unsigned char c)
+{
+	unget(&c,1);
+}
+
+void InputBuffer::unget(const void* p, size_t len)
+{
+	if (!len)
+		return;
+
+	OOXML_COUNT(m_pushback_bytes += len);
+
+	store(p,len);
+	m_ahead += len;
+}
+
+void InputBuffer::inject(unsigned char c)
+{
+	OOXML_COUNT(++m_pushback_bytes);
+
+	store(&c,1);
+	++m_injected;
+}
+
+void InputBuffer::store(const void* p, size_t len)
+{
+	if (!top_is_store())
+	{
+		// The store is unused, start again at its back
+		push_span(m_store + m_alloc,m_store + m_alloc,true);
+	}
+
+	Span& s = m_spans[m_top-1];
+	if (static_cast<size_t>(s.m_ptr - m_store) < len)
+		grow(len);
+
+	m_spans[m_top-1].m_ptr -= len;
+	memcpy(const_cast<unsigned char*>(m_spans[m_top-1].m_ptr),p,len);
+}
+
+void InputBuffer::insert(const void* p, size_t len)
+{
+	// Pushed-back bytes must be read first, so cannot be buried
+	if (top_is_store())
+		throw "Text inserted over pushed-back input";
+
+	if (len)
+		push_span(static_cast<const unsigned char*>(p),static_cast<const unsigned char*>(p) + len,false);
+}
+
+const unsigned char* InputBuffer::peek(size_t& len) const
+{
+	if (!m_top)
+	{
+		len = 0;
+		return NULL;
+	}
+
+	len = m_spans[m_top-1].m_end - m_spans[m_top-1].m_ptr;
+	return m_spans[m_top-1].m_ptr;
+}
+
+void InputBuffer::skip(size_t len)
+{
+	while (len && m_top)
+	{
+		Span& s = m_spans[m_top-1];
+		size_t avail = s.m_end - s.m_ptr;
+		if (len < avail)
+		{
+			if (s.m_pushback)
+				read_back(len);
+			s.m_ptr += len;
+			break;
+		}
+
+		if (s.m_pushback)
+			read_back(avail);
+		len -= avail;
+		--m_top;
+	}
+}
@@ -0,0 +1,129 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INPUTBUFFER_H_INCLUDED_
+#define INPUTBUFFER_H_INCLUDED_
+
+#include <OOBase/Memory.h>
+
+#include "Counters.h"
+
+// A small stack of forward spans, read before the underlying input.
+// Pushed-back bytes live in a store filled from the back, so nothing is
+// ever reversed, and injected text is referenced rather than copied.
+class InputBuffer
+{
+public:
+	InputBuffer(OOBase::AllocatorInstance& allocator);
+	~InputBuffer();
+
+	bool empty() const
+	{
+		return (m_top == 0);
+	}
+
+	unsigned char pop()
+	{
+		Span& s = m_spans[m_top-1];
+		unsigned char c = *s.m_ptr++;
+		if (s.m_pushback)
+			read_back(1);
+		if (s.m_ptr == s.m_end)
+			--m_top;
+
+		return c;
+	}
+
+	// Make the bytes, already read from the input, the next to be read
+	void unget(unsigned char c);
+	void unget(const void* p, size_t len);
+
+	// Make a byte that is not part of the input the next to be read,
+	// it must be read before anything ungot before it
+	void inject(unsigned char c);
+
+	// Bytes ungot and not yet read again
+	size_t ahead() const
+	{
+		return m_ahead;
+	}
+
+	// Inject text to be read next, the text must outlive the buffer
+	void insert(const void* p, size_t len);
+
+	// Bulk access to the next contiguous run of bytes
+	const unsigned char* peek(size_t& len) const;
+	void skip(size_t len);
+
+#if defined(OOXML_COUNTERS)
+	unsigned long long pushback_bytes() const
+	{
+		return m_pushback_bytes;
+	}
+#endif
+
+private:
+	InputBuffer(const InputBuffer&);
+	InputBuffer& operator = (const InputBuffer&);
+
+	struct Span
+	{
+		const unsigned char* m_ptr;
+		const unsigned char* m_end;
+		bool                 m_pushback;
+	};
+
+	static const size_t max_spans = 4;
+	static const size_t inline_size = 16;
+
+	OOBase::AllocatorInstance& m_allocator;
+
+	Span           m_spans[max_spans];
+	size_t         m_top;
+	unsigned char* m_store;
+	size_t         m_alloc;
+	unsigned char  m_inline[inline_size];
+	size_t         m_ahead;
+	size_t         m_injected;
+
+#if defined(OOXML_COUNTERS)
+	unsigned long long m_pushback_bytes;
+#endif
+
+	bool top_is_store() const;
+	void push_span(const unsigned char* ptr, const unsigned char* end, bool pushback);
+	void grow(size_t extra);
+	void store(const void* p, size_t len);
+
+	void read_back(size_t len)
+	{
+		// Injected bytes are always on top
+		if (m_injected >= len)
+			m_injected -= len;
+		else
+		{
+			m_ahead -= len - m_injected;
+			m_injected = 0;
+		}
+	}
+};
+
+#endif // INPUTBUFFER_H_INCLUDED_
@@ -0,0 +1,169 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "NameTable.h"
+
+#include <string.h>
+
+NameTable::NameTable(OOBase::AllocatorInstance& allocator) :
+		m_allocator(allocator),
+		m_entries(NULL),
+		m_count(0),
+		m_entry_alloc(0),
+		m_slots(NULL),
+		m_slot_alloc(0),
+		m_store(NULL),
+		m_store_len(0),
+		m_store_alloc(0)
+{
+}
+
+NameTable::~NameTable()
+{
+	m_allocator.free(m_entries);
+	m_allocator.free(m_slots);
+	m_allocator.free(m_store);
+}
+
+void NameTable::clear()
+{
+	// Keep the capacity for the next document
+	m_count = 0;
+	m_store_len = 0;
+	if (m_slots)
+		memset(m_slots,0,m_slot_alloc * sizeof(unsigned int));
+}
+
+unsigned int NameTable::hash(const char* name, size_t len)
+{
+	// FNV-1a
+	unsigned int h = 2166136261U;
+	for (size_t i = 0;i < len;++i)
+	{
+		h ^= static_cast<unsigned char>(name[i]);
+		h *= 16777619U;
+	}
+	return h;
+}
+
+size_t NameTable::slot(const char* name, size_t len, unsigned int h) const
+{
+	size_t i = h & (m_slot_alloc - 1);
+	for (;;)
+	{
+		unsigned int id = m_slots[i];
+		if (!id)
+			return i;
+
+		const Entry& e = m_entries[id-1];
+		if (e.m_hash == h && e.m_len == len && memcmp(m_store + e.m_offset,name,len) == 0)
+			return i;
+
+		i = (i + 1) & (m_slot_alloc - 1);
+	}
+}
+
+void NameTable::rehash()
+{
+	size_t new_alloc = (m_slot_alloc ? m_slot_alloc * 2 : 64);
+	unsigned int* new_slots = static_cast<unsigned int*>(m_allocator.allocate(new_alloc * sizeof(unsigned int),OOBase::alignment_of<unsigned int>::value));
+	if (!new_slots)
+		throw "Out of memory";
+
+	memset(new_slots,0,new_alloc * sizeof(unsigned int));
+	m_allocator.free(m_slots);
+	m_slots = new_slots;
+	m_slot_alloc = new_alloc;
+
+	for (size_t id = 0;id < m_count;++id)
+	{
+		size_t i = m_entries[id].m_hash & (m_slot_alloc - 1);
+		while (m_slots[i])
+			i = (i + 1) & (m_slot_alloc - 1);
+		m_slots[i] = static_cast<unsigned int>(id + 1);
+	}
+}
+
+unsigned int NameTable::find(const char* name, size_t len) const
+{
+	if (!m_count)
+		return npos;
+
+	unsigned int id = m_slots[slot(name,len,hash(name,len))];
+	return (id ? id - 1 : npos);
+}
+
+unsigned int NameTable::intern(const char* name, size_t len)
+{
+	// Keep the table at most half full
+	if ((m_count + 1) * 2 > m_slot_alloc)
+		rehash();
+
+	unsigned int h = hash(name,len);
+	size_t i = slot(name,len,h);
+	if (m_slots[i])
+		return m_slots[i] - 1;
+
+	if (m_count == m_entry_alloc)
+	{
+		size_t new_alloc = (m_entry_alloc ? m_entry_alloc * 2 : 32);
+		Entry* new_entries = static_cast<Entry*>(m_allocator.reallocate(m_entries,new_alloc * sizeof(Entry),OOBase::alignment_of<Entry>::value));
+		if (!new_entries)
+			throw "Out of memory";
+
+		m_entries = new_entries;
+		m_entry_alloc = new_alloc;
+	}
+
+	if (m_store_len + len + 1 > m_store_alloc)
+	{
+		size_t new_alloc = (m_store_alloc ? m_store_alloc * 2 : 512);
+		while (new_alloc < m_store_len + len + 1)
+			new_alloc *= 2;
+
+		char* new_store = static_cast<char*>(m_allocator.reallocate(m_store,new_alloc,1));
+		if (!new_store)
+			throw "Out of memory";
+
+		m_store = new_store;
+		m_store_alloc = new_alloc;
+	}
+
+	Entry& e = m_entries[m_count];
+	e.m_offset = m_store_len;
+	e.m_len = len;
+	e.m_hash = h;
+
+	memcpy(m_store + m_store_len,name,len);
+	m_store[m_store_len + len] = '\0';
+	m_store_len += len + 1;
+
+	m_slots[i] = static_cast<unsigned int>(++m_count);
+	return static_cast<unsigned int>(m_count - 1);
+}
+
+const char* NameTable::name(unsigned int id) const
+{
+	if (id >= m_count)
+		return "";
+
+	return m_store + m_entries[id].m_offset;
+}
@@ -0,0 +1,76 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef NAMETABLE_H_INCLUDED_
+#define NAMETABLE_H_INCLUDED_
+
+#include <OOBase/Memory.h>
+
+// Interns names as small dense ids, looked up without allocating
+class NameTable
+{
+public:
+	static const unsigned int npos = static_cast<unsigned int>(-1);
+
+	NameTable(OOBase::AllocatorInstance& allocator);
+	~NameTable();
+
+	unsigned int intern(const char* name, size_t len);
+	unsigned int find(const char* name, size_t len) const;
+
+	// NUL terminated
+	const char* name(unsigned int id) const;
+
+	size_t size() const
+	{
+		return m_count;
+	}
+
+	void clear();
+
+private:
+	NameTable(const NameTable&);
+	NameTable& operator = (const NameTable&);
+
+	struct Entry
+	{
+		size_t       m_offset;
+		size_t       m_len;
+		unsigned int m_hash;
+	};
+
+	OOBase::AllocatorInstance& m_allocator;
+
+	Entry*        m_entries;
+	size_t        m_count;
+	size_t        m_entry_alloc;
+	unsigned int* m_slots;       // id + 1, 0 is empty
+	size_t        m_slot_alloc;
+	char*         m_store;
+	size_t        m_store_len;
+	size_t        m_store_alloc;
+
+	static unsigned int hash(const char* name, size_t len);
+	size_t slot(const char* name, size_t len, unsigned int h) const;
+	void rehash();
+};
+
+#endif // NAMETABLE_H_INCLUDED_
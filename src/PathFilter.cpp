@@ -0,0 +1,567 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "PathFilter.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+PathFilter::PathFilter(OOBase::AllocatorInstance& allocator) :
+		m_allocator(allocator),
+		m_names(allocator),
+		m_steps(allocator),
+		m_preds(allocator),
+		m_values(allocator),
+		m_paths(0),
+		m_started(false),
+		m_states(allocator),
+		m_frames(allocator),
+		m_select(npos),
+		m_select_depth(0),
+		m_tag_open(false),
+		m_tag(allocator),
+		m_tag_name_len(0),
+		m_tag_select(npos),
+		m_attrs(allocator),
+		m_candidates(allocator),
+		m_out(allocator),
+		m_out_next(0),
+		m_out_text(allocator)
+{
+}
+
+PathFilter::~PathFilter()
+{
+}
+
+int PathFilter::add(const char* path, size_t& id)
+{
+	size_t steps = m_steps.size();
+	size_t preds = m_preds.size();
+
+	int err = 0;
+	try
+	{
+		err = parse(path);
+	}
+	catch (const char*)
+	{
+		err = ENOMEM;
+	}
+
+	if (err != 0)
+	{
+		while (m_steps.size() > steps)
+			m_steps.pop_back();
+		while (m_preds.size() > preds)
+			m_preds.pop_back();
+
+		return err;
+	}
+
+	m_steps[m_steps.size()-1].m_path = m_paths;
+	id = m_paths++;
+
+	return 0;
+}
+
+int PathFilter::parse(const char* p)
+{
+	if (*p != '/')
+		return EINVAL;
+
+	while (*p == '/')
+	{
+		Step step = { Element, false, NameTable::npos, m_preds.size(), 0, npos };
+		if (*++p == '/')
+		{
+			step.m_descendant = true;
+			++p;
+		}
+
+		if (*p == '@')
+		{
+			step.m_kind = Attribute;
+			++p;
+		}
+		else if (strncmp(p,"text()",6) == 0)
+		{
+			step.m_kind = Text;
+			p += 6;
+		}
+
+		if (step.m_kind != Text)
+		{
+			size_t len = parse_name(p,step.m_name);
+			if (!len)
+				return EINVAL;
+			p += len;
+		}
+
+		while (step.m_kind == Element && *p == '[')
+		{
+			Pred pred = { NameTable::npos, false, 0, 0 };
+			if (*++p != '@')
+				return EINVAL;
+
+			size_t len = parse_name(++p,pred.m_name);
+			if (!len || pred.m_name == NameTable::npos)
+				return EINVAL;
+			p += len;
+
+			if (*p == '=')
+			{
+				char quote = *++p;
+				if (quote != '\'' && quote != '"')
+					return EINVAL;
+
+				const char* end = strchr(++p,quote);
+				if (!end)
+					return EINVAL;
+
+				pred.m_has_value = true;
+				pred.m_value = m_values.length();
+				pred.m_value_len = end - p;
+				m_values.append(p,end - p);
+				p = end + 1;
+			}
+
+			if (*p++ != ']')
+				return EINVAL;
+
+			if (m_preds.push_back(pred) != 0)
+				throw "Out of memory";
+
+			++step.m_pred_count;
+		}
+
+		if (m_steps.push_back(step) != 0)
+			throw "Out of memory";
+
+		// Attributes and text have nothing below them
+		if (step.m_kind != Element)
+			break;
+	}
+
+	return (*p ? EINVAL : 0);
+}
+
+size_t PathFilter::parse_name(const char* p, unsigned int& name)
+{
+	if (*p == '*')
+	{
+		name = NameTable::npos;
+		return 1;
+	}
+
+	size_t len = strcspn(p,"/[]@=()*'\" \t\r\n");
+	if (len)
+		name = m_names.intern(p,len);
+
+	return len;
+}
+
+void PathFilter::reset()
+{
+	m_started = false;
+}
+
+void PathFilter::start()
+{
+	m_states.clear();
+	m_frames.clear();
+	m_select = npos;
+	m_select_depth = 0;
+	m_tag_open = false;
+	m_candidates.clear();
+	m_out.clear();
+	m_out_next = 0;
+	m_out_text.clear();
+
+	// The document node holds the first step of every path
+	if (m_frames.push_back(0) != 0)
+		throw "Out of memory";
+
+	bool first = true;
+	for (size_t i = 0;i < m_steps.size();++i)
+	{
+		if (first)
+			push_state(0,i);
+
+		first = (m_steps[i].m_path != npos);
+	}
+
+	m_started = true;
+}
+
+void PathFilter::truncate(size_t states)
+{
+	while (m_states.size() > states)
+		m_states.pop_back();
+}
+
+void PathFilter::push_state(size_t first, size_t s)
+{
+	for (size_t i = first;i < m_states.size();++i)
+	{
+		if (m_states[i] == s)
+			return;
+	}
+
+	if (m_states.push_back(s) != 0)
+		throw "Out of memory";
+}
+
+void PathFilter::advance(size_t first, size_t s)
+{
+	if (m_steps[s].m_path == npos)
+		push_state(first,s + 1);
+	else if (m_tag_select == npos)
+		m_tag_select = m_steps[s].m_path;
+}
+
+bool PathFilter::needs_content(size_t first) const
+{
+	for (size_t i = first;i < m_states.size();++i)
+	{
+		const Step& step = m_steps[m_states[i]];
+		if (step.m_kind != Attribute || step.m_descendant)
+			return true;
+	}
+
+	for (size_t i = 0;i < m_candidates.size();++i)
+	{
+		size_t s = m_candidates[i];
+		if (m_steps[s].m_path != npos || m_steps[s+1].m_kind != Attribute || m_steps[s+1].m_descendant)
+			return true;
+	}
+
+	return false;
+}
+
+bool PathFilter::matches(const Step& step) const
+{
+	for (size_t p = step.m_first_pred;p < step.m_first_pred + step.m_pred_count;++p)
+	{
+		const Pred& pred = m_preds[p];
+
+		bool found = false;
+		for (size_t a = 0;!found && a < m_attrs.size();++a)
+		{
+			const Attr& attr = m_attrs[a];
+			if (attr.m_name == pred.m_name)
+			{
+				found = (!pred.m_has_value ||
+						(attr.m_value_len == pred.m_value_len && memcmp(m_tag.data() + attr.m_offset + attr.m_name_len,m_values.data() + pred.m_value,pred.m_value_len) == 0));
+			}
+		}
+
+		if (!found)
+			return false;
+	}
+
+	return true;
+}
+
+void PathFilter::resolve(size_t first)
+{
+	for (size_t i = 0;i < m_candidates.size();++i)
+	{
+		if (matches(m_steps[m_candidates[i]]))
+			advance(first,m_candidates[i]);
+	}
+
+	m_candidates.clear();
+}
+
+bool PathFilter::element_start(Tokenizer& tokenizer, const OOBase::LocalString& strToken, int verbose)
+{
+	size_t parent = m_frames[m_frames.size()-1];
+	size_t first = m_states.size();
+	unsigned int name = m_names.find(strToken.c_str(),strToken.length());
+
+	m_tag_select = npos;
+	m_candidates.clear();
+	for (size_t i = parent;i < first;++i)
+	{
+		size_t s = m_states[i];
+		const Step& step = m_steps[s];
+
+		// '//' steps carry on matching further down
+		if (step.m_descendant)
+			push_state(first,s);
+
+		if (step.m_kind == Element && (step.m_name == NameTable::npos || step.m_name == name))
+		{
+			if (!step.m_pred_count)
+				advance(first,s);
+			else if (m_candidates.push_back(s) != 0)
+				throw "Out of memory";
+		}
+	}
+
+	if (first == m_states.size() && m_candidates.empty() && m_tag_select == npos)
+	{
+		// Nothing can match within
+		return (tokenizer.skip_element(verbose) != Tokenizer::Error);
+	}
+
+	m_tag.clear();
+	m_tag.append(strToken.c_str(),strToken.length());
+	m_tag_name_len = strToken.length();
+	m_attrs.clear();
+
+	if (m_tag_select == npos && !needs_content(first))
+	{
+		// Only attributes can be selected, so the content is passed over
+		OOBase::LocalString strAttr(m_allocator);
+		Tokenizer::TokenType type;
+		while ((type = tokenizer.skip_content(strAttr,verbose)) == Tokenizer::AttributeName || type == Tokenizer::AttributeValue)
+			attribute(type,strAttr);
+
+		if (type == Tokenizer::Error)
+			return false;
+
+		resolve(first);
+		select_attributes(first,npos,false);
+		truncate(first);
+		return true;
+	}
+
+	if (m_frames.push_back(first) != 0)
+		throw "Out of memory";
+
+	m_tag_open = true;
+	return true;
+}
+
+void PathFilter::attribute(Tokenizer::TokenType type, const OOBase::LocalString& strToken)
+{
+	if (type == Tokenizer::AttributeName)
+	{
+		Attr attr = { m_names.find(strToken.c_str(),strToken.length()), m_tag.length(), strToken.length(), 0 };
+		if (m_attrs.push_back(attr) != 0)
+			throw "Out of memory";
+	}
+	else if (!m_attrs.empty())
+		m_attrs[m_attrs.size()-1].m_value_len = strToken.length();
+
+	m_tag.append(strToken.c_str(),strToken.length());
+}
+
+bool PathFilter::tag_end(Tokenizer& tokenizer, Tokenizer::TokenType type, const OOBase::LocalString& strToken, int verbose)
+{
+	m_tag_open = false;
+
+	size_t first = m_frames[m_frames.size()-1];
+	resolve(first);
+
+	if (m_tag_select != npos)
+	{
+		// The element is returned whole
+		m_frames.pop_back();
+		truncate(first);
+
+		queue(Tokenizer::ElementStart,m_tag_select,m_tag.data(),m_tag_name_len);
+		select_attributes(first,m_tag_select,true);
+
+		m_select = m_tag_select;
+		m_select_depth = 1;
+		selected(type,strToken);
+		return true;
+	}
+
+	select_attributes(first,npos,false);
+
+	if (needs_content(first))
+		return content(tokenizer,type,strToken,verbose);
+
+	m_frames.pop_back();
+	truncate(first);
+
+	// The token read to find the end of the start tag is already within the element
+	if (type == Tokenizer::ElementEnd)
+		return true;
+
+	if (type == Tokenizer::ElementStart && tokenizer.skip_element(verbose) == Tokenizer::Error)
+		return false;
+
+	return (tokenizer.skip_element(verbose) != Tokenizer::Error);
+}
+
+void PathFilter::select_attributes(size_t first, size_t id, bool all)
+{
+	for (size_t a = 0;a < m_attrs.size();++a)
+	{
+		const Attr& attr = m_attrs[a];
+
+		size_t path = id;
+		for (size_t i = first;!all && path == npos && i < m_states.size();++i)
+		{
+			const Step& step = m_steps[m_states[i]];
+			if (step.m_kind == Attribute && (step.m_name == NameTable::npos || step.m_name == attr.m_name))
+				path = step.m_path;
+		}
+
+		if (path != npos)
+		{
+			queue(Tokenizer::AttributeName,path,m_tag.data() + attr.m_offset,attr.m_name_len);
+			queue(Tokenizer::AttributeValue,path,m_tag.data() + attr.m_offset + attr.m_name_len,attr.m_value_len);
+		}
+	}
+}
+
+bool PathFilter::content(Tokenizer& tokenizer, Tokenizer::TokenType type, const OOBase::LocalString& strToken, int verbose)
+{
+	size_t first = m_frames[m_frames.size()-1];
+
+	switch (type)
+	{
+	case Tokenizer::ElementStart:
+		return element_start(tokenizer,strToken,verbose);
+
+	case Tokenizer::ElementEnd:
+		m_frames.pop_back();
+		truncate(first);
+		break;
+
+	case Tokenizer::Text:
+	case Tokenizer::CData:
+		for (size_t i = first;i < m_states.size();++i)
+		{
+			const Step& step = m_steps[m_states[i]];
+			if (step.m_kind == Text)
+			{
+				queue(type,step.m_path,strToken.c_str(),strToken.length());
+				break;
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return true;
+}
+
+void PathFilter::selected(Tokenizer::TokenType type, const OOBase::LocalString& strToken)
+{
+	queue(type,m_select,strToken.c_str(),strToken.length());
+
+	if (type == Tokenizer::ElementStart)
+		++m_select_depth;
+	else if (type == Tokenizer::ElementEnd && --m_select_depth == 0)
+		m_select = npos;
+}
+
+void PathFilter::queue(Tokenizer::TokenType type, size_t id, const char* p, size_t len)
+{
+	Out o = { type, id, m_out_text.length(), len };
+	m_out_text.append(p,len);
+
+	if (m_out.push_back(o) != 0)
+		throw "Out of memory";
+}
+
+Tokenizer::TokenType PathFilter::pop_out(OOBase::LocalString& strToken, size_t& id)
+{
+	const Out& o = m_out[m_out_next++];
+	Tokenizer::TokenType type = o.m_type;
+	id = o.m_id;
+
+	int err = strToken.assign(m_out_text.data() + o.m_offset,o.m_len);
+	if (err != 0)
+		throw "Out of memory";
+
+	if (m_out_next == m_out.size())
+	{
+		m_out.clear();
+		m_out_next = 0;
+		m_out_text.clear();
+	}
+
+	return type;
+}
+
+Tokenizer::TokenType PathFilter::next_token(Tokenizer& tokenizer, OOBase::LocalString& strToken, size_t& id, int verbose)
+{
+	try
+	{
+		if (!m_started)
+			start();
+
+		Tokenizer::TokenType type = Tokenizer::Error;
+		for (;;)
+		{
+			if (m_out_next < m_out.size())
+				return pop_out(strToken,id);
+
+			type = tokenizer.next_token(strToken,verbose);
+			if (type == Tokenizer::Error || type == Tokenizer::End)
+				break;
+
+			if (m_select != npos)
+			{
+				// Within a selected element everything is returned, as it is
+				id = m_select;
+				if (type == Tokenizer::ElementStart)
+					++m_select_depth;
+				else if (type == Tokenizer::ElementEnd && --m_select_depth == 0)
+					m_select = npos;
+
+				return type;
+			}
+
+			bool ok;
+			if (!m_tag_open)
+				ok = content(tokenizer,type,strToken,verbose);
+			else if (type == Tokenizer::AttributeName || type == Tokenizer::AttributeValue)
+			{
+				attribute(type,strToken);
+				ok = true;
+			}
+			else
+				ok = tag_end(tokenizer,type,strToken,verbose);
+
+			if (!ok)
+			{
+				m_started = false;
+				id = npos;
+				return Tokenizer::Error;
+			}
+		}
+
+		m_started = false;
+		id = npos;
+		return type;
+	}
+	catch (const char* e)
+	{
+		if (verbose >= 1)
+			printf("Exception %s\n",e);
+	}
+
+	m_started = false;
+	id = npos;
+	return Tokenizer::Error;
+}
@@ -0,0 +1,153 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PATHFILTER_H_INCLUDED_
+#define PATHFILTER_H_INCLUDED_
+
+#include <OOBase/String.h>
+#include <OOBase/Vector.h>
+
+#include "NameTable.h"
+#include "Token.h"
+#include "Tokenizer.h"
+
+// A set of simple location paths, compiled to steps over interned names and run
+// against a Tokenizer's tokens, so only what a path selects is returned.
+// Elements no path can match within are passed over with Tokenizer::skip_element().
+class PathFilter
+{
+public:
+	static const size_t npos = size_t(-1);
+
+	PathFilter(OOBase::AllocatorInstance& allocator);
+	~PathFilter();
+
+	// Paths are absolute: steps of a name or '*', each with any number of [@name] or
+	// [@name='value'] predicates, joined by '/' or '//'. The last step may instead be
+	// @name, @* or text(). Returns 0, EINVAL or ENOMEM, and sets id to the path's index.
+	int add(const char* path, size_t& id);
+
+	// Abandons the current document, the next token starts another
+	void reset();
+
+	// The next token selected by a path, id is the index of the path.
+	// A selected element is returned whole, from ElementStart to ElementEnd, and paths are
+	// not run within it. Selected attributes are returned as AttributeName and AttributeValue,
+	// and selected text as Text or CData. End and Error are returned as by the Tokenizer.
+	Tokenizer::TokenType next_token(Tokenizer& tokenizer, OOBase::LocalString& strToken, size_t& id, int verbose = 0);
+
+private:
+	PathFilter(const PathFilter&);
+	PathFilter& operator = (const PathFilter&);
+
+	enum Kind
+	{
+		Element = 0,
+		Attribute,
+		Text
+	};
+
+	struct Step
+	{
+		unsigned char m_kind;
+		bool          m_descendant;
+		unsigned int  m_name;         // NameTable::npos for '*'
+		size_t        m_first_pred;
+		size_t        m_pred_count;
+		size_t        m_path;         // The path this step ends, or npos
+	};
+
+	struct Pred
+	{
+		unsigned int m_name;
+		bool         m_has_value;
+		size_t       m_value;         // Offset into m_values
+		size_t       m_value_len;
+	};
+
+	struct Attr
+	{
+		unsigned int m_name;
+		size_t       m_offset;        // Name then value, in m_tag
+		size_t       m_name_len;
+		size_t       m_value_len;
+	};
+
+	struct Out
+	{
+		Tokenizer::TokenType m_type;
+		size_t               m_id;
+		size_t               m_offset;
+		size_t               m_len;
+	};
+
+	OOBase::AllocatorInstance& m_allocator;
+
+	// The compiled paths, a state is the index of the step to match next
+	NameTable m_names;
+	OOBase::Vector<Step,OOBase::AllocatorInstance> m_steps;
+	OOBase::Vector<Pred,OOBase::AllocatorInstance> m_preds;
+	Token  m_values;
+	size_t m_paths;
+
+	// The states of each open element, end to end
+	bool m_started;
+	OOBase::Vector<size_t,OOBase::AllocatorInstance> m_states;
+	OOBase::Vector<size_t,OOBase::AllocatorInstance> m_frames;
+	size_t m_select;          // The path selecting the element being returned, or npos
+	size_t m_select_depth;
+
+	// The start tag being read
+	bool   m_tag_open;
+	Token  m_tag;
+	size_t m_tag_name_len;
+	size_t m_tag_select;
+	OOBase::Vector<Attr,OOBase::AllocatorInstance>   m_attrs;
+	OOBase::Vector<size_t,OOBase::AllocatorInstance> m_candidates;   // Waiting on predicates
+
+	// Tokens waiting to be returned
+	OOBase::Vector<Out,OOBase::AllocatorInstance> m_out;
+	size_t m_out_next;
+	Token  m_out_text;
+
+	int parse(const char* path);
+	size_t parse_name(const char* p, unsigned int& name);
+
+	void start();
+	void truncate(size_t states);
+	void push_state(size_t first, size_t s);
+	void advance(size_t first, size_t s);
+	bool needs_content(size_t first) const;
+	bool matches(const Step& step) const;
+	void resolve(size_t first);
+
+	bool element_start(Tokenizer& tokenizer, const OOBase::LocalString& strToken, int verbose);
+	void attribute(Tokenizer::TokenType type, const OOBase::LocalString& strToken);
+	bool tag_end(Tokenizer& tokenizer, Tokenizer::TokenType type, const OOBase::LocalString& strToken, int verbose);
+	void select_attributes(size_t first, size_t id, bool all);
+	bool content(Tokenizer& tokenizer, Tokenizer::TokenType type, const OOBase::LocalString& strToken, int verbose);
+	void selected(Tokenizer::TokenType type, const OOBase::LocalString& strToken);
+
+	void queue(Tokenizer::TokenType type, size_t id, const char* p, size_t len);
+	Tokenizer::TokenType pop_out(OOBase::LocalString& strToken, size_t& id);
+};
+
+#endif // PATHFILTER_H_INCLUDED_
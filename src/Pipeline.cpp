@@ -0,0 +1,481 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "Pipeline.h"
+#include "ReadAhead.h"
+#include "Decompressor.h"
+
+#include <OOBase/ArenaAllocator.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+	template <Decoder::eType T>
+	size_t decode_block(Decoder& decoder, const unsigned char*& in, const unsigned char* in_end, unsigned char* out, size_t out_len)
+	{
+		size_t n = 0;
+		while (in != in_end && n < out_len)
+		{
+			bool again = false;
+			unsigned char c = decoder.next<T>(*in++,again);
+			if (!again)
+				out[n++] = c;
+		}
+		return n;
+	}
+}
+
+Pipeline::Pipeline(OOBase::AllocatorInstance& allocator) :
+		m_allocator(allocator),
+		m_resolver(NULL),
+		m_fname(NULL),
+		m_input(NULL),
+		m_decompressor(NULL),
+		m_decoded(Decoder::None),
+		m_stop(0),
+		m_exited(0),
+		m_reader(false),
+		m_tokenizer(false),
+		m_started(false),
+		m_out(NULL),
+		m_batch(NULL),
+		m_read(0),
+		m_finished(false)
+{
+	for (size_t i = 0;i < ring_size;++i)
+	{
+		m_blocks[i].m_data = NULL;
+		m_batches[i].m_data = NULL;
+	}
+}
+
+Pipeline::~Pipeline()
+{
+	stop();
+
+	if (m_decompressor)
+		m_decompressor->destroy();
+
+	if (m_input)
+		m_input->destroy();
+
+	for (size_t i = 0;i < ring_size;++i)
+	{
+		m_allocator.free(m_blocks[i].m_data);
+		m_allocator.free(m_batches[i].m_data);
+	}
+
+	m_allocator.free(m_fname);
+}
+
+void Pipeline::set_resolver(Resolver& resolver)
+{
+	m_resolver = &resolver;
+}
+
+void Pipeline::start(const char* fname)
+{
+	if (m_started || m_input)
+		throw "Pipeline already started";
+
+	size_t len = strlen(fname) + 1;
+	m_fname = static_cast<char*>(m_allocator.allocate(len,1));
+	if (!m_fname)
+		throw "Out of memory";
+	memcpy(m_fname,fname,len);
+
+	for (size_t i = 0;i < ring_size;++i)
+	{
+		m_blocks[i].m_data = static_cast<unsigned char*>(m_allocator.allocate(block_size,16));
+		m_batches[i].m_data = static_cast<char*>(m_allocator.allocate(block_size,16));
+		if (!m_blocks[i].m_data || !m_batches[i].m_data)
+			throw "Out of memory";
+	}
+
+	// Open on this thread, so a missing file is reported here
+	int err = 0;
+	m_input = ReadAhead::create(m_allocator,fname,err);
+	if (!m_input)
+		throw "IO Error";
+
+	m_decompressor = Decompressor::create(m_allocator,*m_input);
+	if (!m_decompressor)
+		throw "Out of memory";
+
+	if (m_reader.run(&reader,this) != 0)
+		throw "Failed to start thread";
+
+	if (m_tokenizer.run(&tokenizer,this) != 0)
+	{
+		store_release(m_stop,1);
+		m_blocks.wake();
+		m_reader.join();
+		throw "Failed to start thread";
+	}
+
+	m_started = true;
+}
+
+void Pipeline::stop()
+{
+	if (m_started)
+	{
+		store_release(m_stop,1);
+		m_blocks.wake();
+		m_batches.wake();
+		m_reader.join();
+		m_tokenizer.join();
+		m_started = false;
+	}
+}
+
+int Pipeline::reader(void* param)
+{
+	static_cast<Pipeline*>(param)->run_reader();
+	return 0;
+}
+
+void Pipeline::run_reader()
+{
+	Decoder decoder;
+	bool first = true;
+	size_t raw = 0;
+	int err = 0;
+
+	for (;;)
+	{
+		size_t len = 0;
+		const unsigned char* in = NULL;
+		try
+		{
+			in = m_decompressor->next(len);
+		}
+		catch (const char*)
+		{
+			// Corrupt compressed input reads as an IO error
+			err = EIO;
+		}
+
+		if (first)
+		{
+			// The bytes before IOState::init selects its decoder pass through raw
+			first = false;
+			m_decoded = Decoder::sniff(in,len,raw);
+			decoder.reset(m_decoded);
+		}
+
+		if (!len)
+			break;
+
+		const unsigned char* in_end = in + len;
+		while (in != in_end)
+		{
+			Block* b = m_blocks.wait_producer_slot(m_stop);
+			if (!b)
+				return;
+
+			size_t n = 0;
+			if (raw)
+			{
+				n = raw;
+				memcpy(b->m_data,in,n);
+				in += n;
+				raw = 0;
+			}
+
+			n += decode(decoder,in,in_end,b->m_data + n,block_size - n);
+
+			// A block of nothing but padding has nothing to hand on
+			if (n)
+			{
+				b->m_len = n;
+				b->m_err = 0;
+				m_blocks.publish();
+			}
+		}
+	}
+
+	Block* b = m_blocks.wait_producer_slot(m_stop);
+	if (!b)
+		return;
+
+	b->m_len = 0;
+	b->m_err = err;
+	m_blocks.publish();
+}
+
+size_t Pipeline::decode(Decoder& decoder, const unsigned char*& in, const unsigned char* in_end, unsigned char* out, size_t out_len)
+{
+	// Switch once per block, so each decoder runs its own inlined loop
+	switch (decoder.type())
+	{
+	case Decoder::UTF32LE:
+		return decode_block<Decoder::UTF32LE>(decoder,in,in_end,out,out_len);
+
+	case Decoder::UTF32BE:
+		return decode_block<Decoder::UTF32BE>(decoder,in,in_end,out,out_len);
+
+	case Decoder::UTF16LE:
+		return decode_block<Decoder::UTF16LE>(decoder,in,in_end,out,out_len);
+
+	case Decoder::UTF16BE:
+		return decode_block<Decoder::UTF16BE>(decoder,in,in_end,out,out_len);
+
+	case Decoder::EBCDIC:
+		return decode_block<Decoder::EBCDIC>(decoder,in,in_end,out,out_len);
+
+	case Decoder::None:
+	default:
+		{
+			size_t n = static_cast<size_t>(in_end - in);
+			if (n > out_len)
+				n = out_len;
+
+			memcpy(out,in,n);
+			in += n;
+			return n;
+		}
+	}
+}
+
+const unsigned char* Pipeline::Source::next(size_t& len)
+{
+	len = 0;
+
+	// The IO has finished with the last block
+	if (m_held)
+	{
+		m_pipeline.m_blocks.consume();
+		m_held = false;
+	}
+
+	if (m_done)
+		return NULL;
+
+	Block* b = m_pipeline.m_blocks.consumer_slot();
+	if (!b)
+	{
+		// The reader has nothing ready, so hand on what the consumer can already use
+		m_pipeline.flush();
+	}
+
+	if (!b && !(b = m_pipeline.m_blocks.wait_consumer_slot(m_pipeline.m_stop)))
+		throw "Cancelled";
+
+	m_held = true;
+	if (b->m_err != 0)
+	{
+		m_done = true;
+		throw "IO Error";
+	}
+
+	len = b->m_len;
+	if (!len)
+		m_done = true;
+
+	return b->m_data;
+}
+
+Decoder::eType Pipeline::Source::decoded() const
+{
+	// Only asked once the first block has been received
+	return m_pipeline.m_decoded;
+}
+
+OOBase::LocalString Pipeline::DocResolver::resolve_url(const OOBase::LocalString& strBase, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId)
+{
+	return m_resolver.resolve_url(strBase,strPublicId,strSystemId);
+}
+
+int Pipeline::DocResolver::open(IO& io, const OOBase::LocalString& strURL)
+{
+	if (!m_opened && strURL == m_fname)
+	{
+		m_opened = true;
+		return io.open(m_source);
+	}
+
+	return m_resolver.open(io,strURL);
+}
+
+int Pipeline::tokenizer(void* param)
+{
+	Pipeline* p = static_cast<Pipeline*>(param);
+	p->run_tokenizer();
+
+	// Nothing more will be published
+	store_release(p->m_exited,1);
+	p->m_batches.wake();
+	return 0;
+}
+
+void Pipeline::run_tokenizer()
+{
+	// Shares nothing with the consumer while parsing.
+	// The Tokenizer is declared last, so its IO has gone before the Source.
+	OOBase::ArenaAllocator allocator;
+	Source source(*this);
+	DocResolver resolver(m_resolver ? *m_resolver : FileResolver::instance(),source,m_fname);
+
+	Tokenizer tok(allocator);
+	tok.set_resolver(resolver);
+
+	try
+	{
+		OOBase::LocalString strFName(allocator),strToken(allocator);
+		if (strFName.assign(m_fname) != 0)
+			throw "Out of memory";
+
+		tok.load(strFName);
+
+		Tokenizer::TokenType type;
+		do
+		{
+			type = tok.next_token(strToken);
+
+			bool ok = false;
+			if (type == Tokenizer::Error)
+			{
+				char szError[256];
+				snprintf(szError,sizeof(szError),"Syntax error at %s, line %lu, col %lu",tok.get_location().c_str(),(unsigned long)tok.get_line(),(unsigned long)tok.get_column());
+				ok = emit(type,szError,strlen(szError));
+			}
+			else if (type == Tokenizer::End)
+				ok = emit(type,tok.get_validity_error().c_str(),tok.get_validity_error().length());
+			else
+				ok = emit(type,strToken.c_str(),strToken.length());
+
+			if (!ok)
+				break;
+		}
+		while (type != Tokenizer::End && type != Tokenizer::Error);
+	}
+	catch (const char* err)
+	{
+		emit(Tokenizer::Error,err,strlen(err));
+	}
+}
+
+bool Pipeline::emit(Tokenizer::TokenType type, const char* data, size_t len)
+{
+	for (;;)
+	{
+		if (!m_out)
+		{
+			if (!(m_out = m_batches.wait_producer_slot(m_stop)))
+				return false;
+
+			m_out->m_len = 0;
+		}
+
+		size_t space = block_size - m_out->m_len;
+		if (space <= sizeof(Record))
+		{
+			m_batches.publish();
+			m_out = NULL;
+			continue;
+		}
+
+		Record r;
+		r.m_type = static_cast<unsigned char>(type);
+		r.m_len = (len < space - sizeof(Record) ? len : space - sizeof(Record));
+		r.m_more = (r.m_len < len ? 1 : 0);
+
+		memcpy(m_out->m_data + m_out->m_len,&r,sizeof(Record));
+		memcpy(m_out->m_data + m_out->m_len + sizeof(Record),data,r.m_len);
+		m_out->m_len += sizeof(Record) + r.m_len;
+		data += r.m_len;
+		len -= r.m_len;
+
+		if (!r.m_more)
+			break;
+	}
+
+	// Nothing follows the last token
+	if (type == Tokenizer::End || type == Tokenizer::Error)
+		flush();
+
+	return true;
+}
+
+void Pipeline::flush()
+{
+	if (m_out && m_out->m_len)
+	{
+		m_batches.publish();
+		m_out = NULL;
+	}
+}
+
+Tokenizer::TokenType Pipeline::next_token(OOBase::LocalString& strToken)
+{
+	strToken.clear();
+
+	if (m_finished)
+		return Tokenizer::End;
+
+	if (!m_started)
+		return Tokenizer::Error;
+
+	for (;;)
+	{
+		if (!m_batch)
+		{
+			// The tokenizer thread always ends with End or Error, unless it was stopped
+			if (!(m_batch = m_batches.wait_consumer_slot(m_exited)))
+			{
+				m_finished = true;
+				if (strToken.assign("Pipeline stopped") != 0)
+					throw "Out of memory";
+				return Tokenizer::Error;
+			}
+
+			m_read = 0;
+		}
+
+		if (m_read == m_batch->m_len)
+		{
+			m_batches.consume();
+			m_batch = NULL;
+			continue;
+		}
+
+		Record r;
+		memcpy(&r,m_batch->m_data + m_read,sizeof(Record));
+		m_read += sizeof(Record);
+
+		if (r.m_len && strToken.append(m_batch->m_data + m_read,r.m_len) != 0)
+			throw "Out of memory";
+		m_read += r.m_len;
+
+		if (!r.m_more)
+		{
+			Tokenizer::TokenType type = static_cast<Tokenizer::TokenType>(r.m_type);
+			if (type == Tokenizer::End || type == Tokenizer::Error)
+				m_finished = true;
+
+			return type;
+		}
+	}
+}
@@ -0,0 +1,151 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PIPELINE_H_INCLUDED_
+#define PIPELINE_H_INCLUDED_
+
+#include <OOBase/Thread.h>
+
+#include "Tokenizer.h"
+#include "SpscRing.h"
+
+class ReadAhead;
+class Decompressor;
+
+// Parses one document on three threads: a reader thread reads, decompresses and decodes the file,
+// a tokenizer thread runs a Tokenizer over the decoded blocks, and the caller consumes
+// the tokens. The stages are joined by lock-free single producer, single consumer rings.
+class Pipeline
+{
+public:
+	static const size_t block_size = 64 * 1024;
+	static const size_t ring_size = 8;
+
+	Pipeline(OOBase::AllocatorInstance& allocator);
+	~Pipeline();
+
+	// The resolver is not owned, it is used on the tokenizer thread
+	void set_resolver(Resolver& resolver);
+
+	// Throws if the file cannot be opened
+	void start(const char* fname);
+
+	// As Tokenizer::next_token, except that on Error strToken holds the reason, and on End
+	// it holds the first validity error, or is empty if the document is valid.
+	// Waits for the tokenizer thread, sleeping if it is slow.
+	Tokenizer::TokenType next_token(OOBase::LocalString& strToken);
+
+private:
+	Pipeline(const Pipeline&);
+	Pipeline& operator = (const Pipeline&);
+
+	struct Block
+	{
+		unsigned char* m_data;
+		size_t         m_len;    // 0 marks the end of the file
+		int            m_err;
+	};
+
+	struct Batch
+	{
+		char*  m_data;
+		size_t m_len;
+	};
+
+	// Precedes each token in a Batch, a token too long for one Batch continues in the next
+	struct Record
+	{
+		unsigned char m_type;
+		unsigned char m_more;
+		size_t        m_len;
+	};
+
+	// The tokenizer thread's view of the decoded blocks
+	class Source : public BlockSource
+	{
+	public:
+		Source(Pipeline& pipeline) : m_pipeline(pipeline), m_held(false), m_done(false)
+		{}
+
+		virtual const unsigned char* next(size_t& len);
+		virtual Decoder::eType decoded() const;
+
+	private:
+		Pipeline& m_pipeline;
+		bool      m_held;
+		bool      m_done;
+	};
+
+	// Serves the document from the Source, and everything else from the real resolver
+	class DocResolver : public Resolver
+	{
+	public:
+		DocResolver(Resolver& resolver, Source& source, const char* fname) :
+			m_resolver(resolver), m_source(source), m_fname(fname), m_opened(false)
+		{}
+
+		virtual OOBase::LocalString resolve_url(const OOBase::LocalString& strBase, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId);
+		virtual int open(IO& io, const OOBase::LocalString& strURL);
+
+	private:
+		Resolver&   m_resolver;
+		Source&     m_source;
+		const char* m_fname;
+		bool        m_opened;
+	};
+
+	OOBase::AllocatorInstance& m_allocator;
+	Resolver*                  m_resolver;
+	char*                      m_fname;
+	ReadAhead*                 m_input;
+	Decompressor*              m_decompressor;
+	Decoder::eType             m_decoded;    // Written before the first Block is published
+	volatile size_t            m_stop;
+	volatile size_t            m_exited;     // Set as the tokenizer thread returns
+
+	SpscRing<Block,ring_size> m_blocks;
+	SpscRing<Batch,ring_size> m_batches;
+
+	OOBase::Thread m_reader;
+	OOBase::Thread m_tokenizer;
+	bool           m_started;
+
+	// The tokenizer thread's batch, not yet published
+	Batch* m_out;
+
+	// The consumer's position
+	Batch* m_batch;
+	size_t m_read;
+	bool   m_finished;
+
+	static int reader(void* param);
+	void run_reader();
+	size_t decode(Decoder& decoder, const unsigned char*& in, const unsigned char* in_end, unsigned char* out, size_t out_len);
+
+	static int tokenizer(void* param);
+	void run_tokenizer();
+	bool emit(Tokenizer::TokenType type, const char* data, size_t len);
+	void flush();
+
+	void stop();
+};
+
+#endif // PIPELINE_H_INCLUDED_
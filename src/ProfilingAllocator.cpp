@@ -0,0 +1,228 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "ProfilingAllocator.h"
+
+#include <string.h>
+
+#if defined(_MSC_VER)
+#define OOXML_THREAD_LOCAL __declspec(thread)
+#else
+#define OOXML_THREAD_LOCAL __thread
+#endif
+
+namespace
+{
+	OOXML_THREAD_LOCAL int s_category = ProfilingAllocator::Other;
+
+	const char* const s_names[ProfilingAllocator::MaxCategory] =
+	{
+		"Other",
+		"TokenBuffers",
+		"IOState",
+		"EntityTables",
+		"Strings"
+	};
+
+	size_t bucket(size_t bytes)
+	{
+		size_t b = 0;
+		while (bytes > 1 && b < 31)
+		{
+			bytes >>= 1;
+			++b;
+		}
+		return b;
+	}
+}
+
+// Sits immediately before every block handed out
+struct ProfilingAllocator::Header
+{
+	size_t         m_size;
+	unsigned short m_offset;
+	unsigned char  m_category;
+};
+
+ProfilingAllocator::Scope::Scope(Category c) :
+		m_prev(static_cast<Category>(s_category))
+{
+	if (m_prev == Other)
+		s_category = c;
+}
+
+ProfilingAllocator::Scope::~Scope()
+{
+	s_category = m_prev;
+}
+
+ProfilingAllocator::ProfilingAllocator(OOBase::AllocatorInstance& parent) :
+		m_parent(parent)
+{
+	reset();
+}
+
+void ProfilingAllocator::reset()
+{
+	memset(m_stats,0,sizeof(m_stats));
+	m_live = 0;
+	m_peak = 0;
+}
+
+void ProfilingAllocator::record(Category c, size_t old_size, size_t new_size)
+{
+	Stats& s = m_stats[c];
+	if (old_size < new_size)
+		s.m_bytes += new_size - old_size;
+
+	s.m_live += new_size;
+	s.m_live -= old_size;
+	if (s.m_live > s.m_peak)
+		s.m_peak = s.m_live;
+
+	m_live += new_size;
+	m_live -= old_size;
+	if (m_live > m_peak)
+		m_peak = m_live;
+}
+
+void* ProfilingAllocator::raw_allocate(size_t bytes, size_t align, Category c)
+{
+	if (align < OOBase::alignment_of<Header>::value)
+		align = OOBase::alignment_of<Header>::value;
+
+	size_t offset = (sizeof(Header) + align - 1) & ~(align - 1);
+	unsigned char* p = static_cast<unsigned char*>(m_parent.allocate(bytes + offset,align));
+	if (!p)
+		return NULL;
+
+	p += offset;
+	Header* h = reinterpret_cast<Header*>(p) - 1;
+	h->m_size = bytes;
+	h->m_offset = static_cast<unsigned short>(offset);
+	h->m_category = static_cast<unsigned char>(c);
+
+	return p;
+}
+
+void* ProfilingAllocator::allocate(size_t bytes, size_t align)
+{
+	Category c = static_cast<Category>(s_category);
+	void* p = raw_allocate(bytes,align,c);
+	if (p)
+	{
+		Stats& s = m_stats[c];
+		++s.m_allocs;
+		++s.m_histogram[bucket(bytes)];
+		record(c,0,bytes);
+	}
+	return p;
+}
+
+void* ProfilingAllocator::reallocate(void* ptr, size_t bytes, size_t align)
+{
+	if (!ptr)
+		return allocate(bytes,align);
+
+	Header* h = static_cast<Header*>(ptr) - 1;
+	size_t old_size = h->m_size;
+	size_t offset = h->m_offset;
+	Category c = static_cast<Category>(h->m_category);
+
+	size_t header_align = align;
+	if (header_align < OOBase::alignment_of<Header>::value)
+		header_align = OOBase::alignment_of<Header>::value;
+
+	unsigned char* p = NULL;
+	if (((sizeof(Header) + header_align - 1) & ~(header_align - 1)) == offset)
+	{
+		p = static_cast<unsigned char*>(m_parent.reallocate(static_cast<unsigned char*>(ptr) - offset,bytes + offset,header_align));
+		if (!p)
+			return NULL;
+
+		p += offset;
+		h = reinterpret_cast<Header*>(p) - 1;
+		h->m_size = bytes;
+	}
+	else
+	{
+		// The alignment changed, so the header offset does too
+		p = static_cast<unsigned char*>(raw_allocate(bytes,align,c));
+		if (!p)
+			return NULL;
+
+		memcpy(p,ptr,old_size < bytes ? old_size : bytes);
+		m_parent.free(static_cast<unsigned char*>(ptr) - offset);
+	}
+
+	// Reallocations stay with the category of the original allocation
+	Stats& s = m_stats[c];
+	++s.m_reallocs;
+	++s.m_histogram[bucket(bytes)];
+	record(c,old_size,bytes);
+
+	return p;
+}
+
+void ProfilingAllocator::free(void* ptr)
+{
+	if (ptr)
+	{
+		Header* h = static_cast<Header*>(ptr) - 1;
+		Category c = static_cast<Category>(h->m_category);
+
+		++m_stats[c].m_frees;
+		record(c,h->m_size,0);
+
+		m_parent.free(static_cast<unsigned char*>(ptr) - h->m_offset);
+	}
+}
+
+unsigned long long ProfilingAllocator::count() const
+{
+	unsigned long long total = 0;
+	for (size_t i = 0;i < MaxCategory;++i)
+		total += m_stats[i].m_allocs + m_stats[i].m_reallocs;
+	return total;
+}
+
+void ProfilingAllocator::report(FILE* f) const
+{
+	fprintf(f,"%-14s %10s %10s %10s %14s %12s\n","category","allocs","reallocs","frees","bytes","peak live");
+	for (size_t i = 0;i < MaxCategory;++i)
+	{
+		const Stats& s = m_stats[i];
+		if (!s.m_allocs && !s.m_reallocs)
+			continue;
+
+		fprintf(f,"%-14s %10llu %10llu %10llu %14llu %12llu\n",s_names[i],s.m_allocs,s.m_reallocs,s.m_frees,s.m_bytes,s.m_peak);
+
+		// Power of two buckets: [2^b, 2^(b+1))
+		fprintf(f,"  sizes:");
+		for (size_t b = 0;b < histogram_size;++b)
+		{
+			if (s.m_histogram[b])
+				fprintf(f," %lu:%llu",1UL << b,s.m_histogram[b]);
+		}
+		fprintf(f,"\n");
+	}
+	fprintf(f,"%-14s %10s %10s %10s %14s %12llu\n","total","","","","",m_peak);
+}
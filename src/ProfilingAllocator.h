@@ -0,0 +1,101 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PROFILINGALLOCATOR_H_INCLUDED_
+#define PROFILINGALLOCATOR_H_INCLUDED_
+
+#include <OOBase/Memory.h>
+
+#include <stdio.h>
+
+// Wraps another allocator, recording count, bytes, peak live bytes and a size
+// histogram per category.  Not thread-safe: use one per Tokenizer.
+class ProfilingAllocator : public OOBase::AllocatorInstance
+{
+public:
+	enum Category
+	{
+		Other = 0,
+		TokenBuffers,
+		IOState,
+		EntityTables,
+		Strings,
+		MaxCategory
+	};
+
+	ProfilingAllocator(OOBase::AllocatorInstance& parent);
+	virtual ~ProfilingAllocator() {}
+
+	void* allocate(size_t bytes, size_t align);
+	void* reallocate(void* ptr, size_t bytes, size_t align);
+	void free(void* ptr);
+
+	unsigned long long count() const;
+	void reset();
+	void report(FILE* f) const;
+
+	// Attributes allocations made on this thread to a category, the outermost scope wins.
+	// Only instrumented call sites built with OOXML_ALLOC_PROFILE set a category.
+	class Scope
+	{
+	public:
+		Scope(Category c);
+		~Scope();
+
+	private:
+		Category m_prev;
+	};
+
+private:
+	ProfilingAllocator(const ProfilingAllocator&);
+	ProfilingAllocator& operator = (const ProfilingAllocator&);
+
+	struct Header;
+
+	static const size_t histogram_size = 32;
+
+	struct Stats
+	{
+		unsigned long long m_allocs;
+		unsigned long long m_reallocs;
+		unsigned long long m_frees;
+		unsigned long long m_bytes;
+		unsigned long long m_live;
+		unsigned long long m_peak;
+		unsigned long long m_histogram[histogram_size];
+	};
+
+	OOBase::AllocatorInstance& m_parent;
+	Stats                      m_stats[MaxCategory];
+	unsigned long long         m_live;
+	unsigned long long         m_peak;
+
+	void* raw_allocate(size_t bytes, size_t align, Category c);
+	void record(Category c, size_t old_size, size_t new_size);
+};
+
+#if defined(OOXML_ALLOC_PROFILE)
+#define OOXML_ALLOC_SCOPE(c) ProfilingAllocator::Scope alloc_scope_(ProfilingAllocator::c)
+#else
+#define OOXML_ALLOC_SCOPE(c) do {} while (false)
+#endif
+
+#endif // PROFILINGALLOCATOR_H_INCLUDED_
@@ -0,0 +1,418 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "ReadAhead.h"
+
+#include <errno.h>
+#include <string.h>
+
+#if defined(HAVE_LIBURING)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+ReadAhead* ReadAhead::create(OOBase::AllocatorInstance& allocator, const char* fname, int& err, bool read_ahead)
+{
+	void* p = allocator.allocate(sizeof(ReadAhead),OOBase::alignment_of<ReadAhead>::value);
+	if (!p)
+	{
+		err = ENOMEM;
+		return NULL;
+	}
+
+	ReadAhead* r = ::new (p) ReadAhead(allocator);
+
+	err = r->open(fname,read_ahead);
+	if (err != 0)
+	{
+		r->destroy();
+		r = NULL;
+	}
+
+	return r;
+}
+
+void ReadAhead::destroy()
+{
+	OOBase::AllocatorInstance& a = m_allocator;
+	this->~ReadAhead();
+	a.free(this);
+}
+
+ReadAhead::ReadAhead(OOBase::AllocatorInstance& allocator) :
+		m_allocator(allocator),
+		m_next(0),
+		m_handed(false),
+		m_done(false),
+		m_sync(false),
+		m_f(NULL),
+		m_thread(false),
+		m_fill(0),
+		m_stop(false)
+#if defined(HAVE_LIBURING)
+		, m_uring(false),
+		m_fd(-1),
+		m_offset(0),
+		m_inflight(0),
+		m_eof(false)
+#endif
+{
+	memset(m_blocks,0,sizeof(m_blocks));
+}
+
+ReadAhead::~ReadAhead()
+{
+#if defined(HAVE_LIBURING)
+	if (m_uring)
+	{
+		// The kernel may still be writing into the blocks
+		while (m_inflight)
+		{
+			struct io_uring_cqe* cqe = NULL;
+			int err = io_uring_wait_cqe(&m_ring,&cqe);
+			if (err == -EINTR)
+				continue;
+			if (err < 0)
+				break;
+
+			io_uring_cqe_seen(&m_ring,cqe);
+			--m_inflight;
+		}
+
+		io_uring_queue_exit(&m_ring);
+	}
+
+	if (m_fd != -1)
+		::close(m_fd);
+#endif
+
+	if (m_f && !m_sync)
+	{
+		{
+			OOBase::Guard<OOBase::Condition::Mutex> guard(m_lock);
+			m_stop = true;
+			m_cond.broadcast();
+		}
+
+		m_thread.join();
+		fclose(m_f);
+	}
+	else if (m_f)
+		fclose(m_f);
+
+	for (size_t i = 0;i < block_count;++i)
+		m_allocator.free(m_blocks[i].m_data);
+}
+
+int ReadAhead::open(const char* fname, bool read_ahead)
+{
+	m_f = fopen(fname,"rb");
+	if (!m_f)
+		return errno;
+
+	// Starting a reader costs more than reading a small file
+	if (fseek(m_f,0,SEEK_END) == 0)
+	{
+		long size = ftell(m_f);
+		rewind(m_f);
+		if (size >= 0 && static_cast<unsigned long>(size) < block_size)
+			return read_whole(static_cast<size_t>(size));
+	}
+
+	if (!read_ahead)
+	{
+		// One block, refilled by each call to next()
+		m_blocks[0].m_data = static_cast<unsigned char*>(m_allocator.allocate(block_size,16));
+		if (!m_blocks[0].m_data)
+			return ENOMEM;
+
+		m_sync = true;
+		return 0;
+	}
+
+	fclose(m_f);
+	m_f = NULL;
+
+	for (size_t i = 0;i < block_count;++i)
+	{
+		m_blocks[i].m_data = static_cast<unsigned char*>(m_allocator.allocate(block_size,16));
+		if (!m_blocks[i].m_data)
+			return ENOMEM;
+	}
+
+#if defined(HAVE_LIBURING)
+	m_fd = ::open(fname,O_RDONLY);
+	if (m_fd == -1)
+		return errno;
+
+	// Fall back to the reader thread if io_uring is not permitted
+	if (io_uring_queue_init(block_count,&m_ring,0) == 0)
+	{
+		m_uring = true;
+		for (size_t i = 0;i < block_count;++i)
+			submit(m_blocks[i]);
+
+		return 0;
+	}
+
+	::close(m_fd);
+	m_fd = -1;
+#endif
+
+	m_f = fopen(fname,"rb");
+	if (!m_f)
+		return errno;
+
+	int err = m_thread.run(&reader,this);
+	if (err != 0)
+	{
+		fclose(m_f);
+		m_f = NULL;
+	}
+
+	return err;
+}
+
+int ReadAhead::read_whole(size_t size)
+{
+	// One short block, so next() hands it out and stops
+	Block& b = m_blocks[0];
+	b.m_data = static_cast<unsigned char*>(m_allocator.allocate(size ? size : 1,16));
+	if (b.m_data)
+	{
+		b.m_len = fread(b.m_data,1,size,m_f);
+		b.m_err = (ferror(m_f) ? EIO : 0);
+		b.m_state = Ready;
+	}
+
+	fclose(m_f);
+	m_f = NULL;
+
+	return (b.m_data ? 0 : ENOMEM);
+}
+
+const unsigned char* ReadAhead::next(size_t& len)
+{
+	if (m_sync)
+		return read_sync(len);
+
+	// The caller has finished with the last block, so it can be refilled
+	if (m_handed)
+	{
+		recycle(m_blocks[(m_next + block_count - 1) % block_count]);
+		m_handed = false;
+	}
+
+	len = 0;
+	if (m_done)
+		return NULL;
+
+	Block& b = m_blocks[m_next];
+
+#if defined(HAVE_LIBURING)
+	if (m_uring)
+		wait_uring(b);
+	else
+#endif
+		wait_thread(b);
+
+	if (b.m_err != 0)
+		throw "IO Error";
+
+	m_next = (m_next + 1) % block_count;
+	m_handed = true;
+
+	// A short block is the last one
+	len = b.m_len;
+	if (len < block_size)
+		m_done = true;
+
+	return b.m_data;
+}
+
+const unsigned char* ReadAhead::read_sync(size_t& len)
+{
+	len = 0;
+	if (m_done)
+		return NULL;
+
+	Block& b = m_blocks[0];
+	b.m_len = fread(b.m_data,1,block_size,m_f);
+	if (b.m_len < block_size)
+	{
+		if (ferror(m_f))
+			throw "IO Error";
+
+		m_done = true;
+	}
+
+	len = b.m_len;
+	return b.m_data;
+}
+
+void ReadAhead::recycle(Block& b)
+{
+#if defined(HAVE_LIBURING)
+	if (m_uring)
+	{
+		submit(b);
+		return;
+	}
+#endif
+
+	OOBase::Guard<OOBase::Condition::Mutex> guard(m_lock);
+	b.m_state = Free;
+	m_cond.broadcast();
+}
+
+int ReadAhead::reader(void* param)
+{
+	return static_cast<ReadAhead*>(param)->run_reader();
+}
+
+int ReadAhead::run_reader()
+{
+	for (;;)
+	{
+		Block& b = m_blocks[m_fill];
+		{
+			OOBase::Guard<OOBase::Condition::Mutex> guard(m_lock);
+			while (!m_stop && b.m_state != Free)
+				m_cond.wait(m_lock);
+
+			if (m_stop)
+				break;
+
+			b.m_state = Reading;
+		}
+
+		size_t r = fread(b.m_data,1,block_size,m_f);
+		int err = (r < block_size && ferror(m_f) ? EIO : 0);
+
+		{
+			OOBase::Guard<OOBase::Condition::Mutex> guard(m_lock);
+			b.m_len = r;
+			b.m_err = err;
+			b.m_state = Ready;
+			m_cond.broadcast();
+		}
+
+		// The caller stops at the first short block
+		if (r < block_size)
+			break;
+
+		m_fill = (m_fill + 1) % block_count;
+	}
+
+	return 0;
+}
+
+void ReadAhead::wait_thread(Block& b)
+{
+	OOBase::Guard<OOBase::Condition::Mutex> guard(m_lock);
+	while (b.m_state != Ready)
+		m_cond.wait(m_lock);
+}
+
+#if defined(HAVE_LIBURING)
+
+void ReadAhead::submit(Block& b)
+{
+	b.m_offset = m_offset;
+	b.m_len = 0;
+	b.m_err = 0;
+	m_offset += block_size;
+
+	if (m_eof)
+	{
+		// Nothing to read past the end
+		b.m_state = Ready;
+		return;
+	}
+
+	queue_read(b);
+}
+
+void ReadAhead::queue_read(Block& b)
+{
+	struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+	if (!sqe)
+	{
+		b.m_err = EBUSY;
+		b.m_state = Ready;
+		return;
+	}
+
+	io_uring_prep_read(sqe,m_fd,b.m_data + b.m_len,static_cast<unsigned int>(block_size - b.m_len),b.m_offset + b.m_len);
+	io_uring_sqe_set_data(sqe,&b);
+
+	int err = io_uring_submit(&m_ring);
+	if (err < 0)
+	{
+		b.m_err = -err;
+		b.m_state = Ready;
+		return;
+	}
+
+	b.m_state = Reading;
+	++m_inflight;
+}
+
+void ReadAhead::wait_uring(Block& want)
+{
+	// Completions may arrive in any order
+	while (want.m_state != Ready)
+	{
+		struct io_uring_cqe* cqe = NULL;
+		int err = io_uring_wait_cqe(&m_ring,&cqe);
+		if (err == -EINTR)
+			continue;
+		if (err < 0)
+			throw "IO Error";
+
+		Block* b = static_cast<Block*>(io_uring_cqe_get_data(cqe));
+		int res = cqe->res;
+		io_uring_cqe_seen(&m_ring,cqe);
+		--m_inflight;
+
+		if (res < 0)
+		{
+			b->m_err = -res;
+			b->m_state = Ready;
+		}
+		else if (res == 0)
+		{
+			m_eof = true;
+			b->m_state = Ready;
+		}
+		else
+		{
+			// Finish a short read, the next one will find the end of file if that is why
+			b->m_len += static_cast<size_t>(res);
+			if (b->m_len < block_size)
+				queue_read(*b);
+			else
+				b->m_state = Ready;
+		}
+	}
+}
+
+#endif // HAVE_LIBURING
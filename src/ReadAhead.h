@@ -0,0 +1,122 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef READAHEAD_H_INCLUDED_
+#define READAHEAD_H_INCLUDED_
+
+#include <OOBase/Memory.h>
+#include <OOBase/Condition.h>
+#include <OOBase/Thread.h>
+
+#include <stdio.h>
+
+#include "IO.h"
+
+#if defined(HAVE_LIBURING)
+#include <liburing.h>
+#endif
+
+// Keeps several blocks of a file in flight, so the next block is usually
+// already in memory when the tokenizer finishes the current one.
+// Uses io_uring when built with HAVE_LIBURING (configure --with-liburing)
+// and the kernel allows it, otherwise a reader thread.
+// A file smaller than a block is read whole when it is opened, on the calling thread.
+//
+// Without io_uring, each open of a larger file starts its own reader thread, and every
+// open allocates block_count blocks. Inputs that gain little from it, such as external
+// entities, or documents that already have a thread each, open without read-ahead and
+// are read a block at a time on the calling thread.
+class ReadAhead : public BlockSource
+{
+public:
+	static const size_t block_size = 128 * 1024;
+	static const size_t block_count = 4;
+
+	// Returns NULL and sets err if the file cannot be opened
+	static ReadAhead* create(OOBase::AllocatorInstance& allocator, const char* fname, int& err, bool read_ahead = true);
+	void destroy();
+
+	// The next block in file order, valid until the following call.
+	// len is 0 at end of file.
+	virtual const unsigned char* next(size_t& len);
+
+private:
+	ReadAhead(OOBase::AllocatorInstance& allocator);
+	virtual ~ReadAhead();
+
+	ReadAhead(const ReadAhead&);
+	ReadAhead& operator = (const ReadAhead&);
+
+	enum State
+	{
+		Free = 0,
+		Reading,
+		Ready
+	};
+
+	struct Block
+	{
+		unsigned char*     m_data;
+		size_t             m_len;
+		unsigned long long m_offset;
+		int                m_state;
+		int                m_err;
+	};
+
+	OOBase::AllocatorInstance& m_allocator;
+	Block                      m_blocks[block_count];
+	size_t                     m_next;      // The block to hand out next
+	bool                       m_handed;    // The block before m_next is with the caller
+	bool                       m_done;      // The caller has seen the end of the file
+	bool                       m_sync;      // Opened without read-ahead, next() reads
+
+	// Reader thread
+	FILE*                      m_f;
+	OOBase::Thread             m_thread;
+	OOBase::Condition::Mutex   m_lock;
+	OOBase::Condition          m_cond;
+	size_t                     m_fill;
+	bool                       m_stop;
+
+	static int reader(void* param);
+	int run_reader();
+	void wait_thread(Block& b);
+
+#if defined(HAVE_LIBURING)
+	bool               m_uring;
+	struct io_uring    m_ring;
+	int                m_fd;
+	unsigned long long m_offset;
+	size_t             m_inflight;
+	bool               m_eof;
+
+	void submit(Block& b);
+	void queue_read(Block& b);
+	void wait_uring(Block& b);
+#endif
+
+	int open(const char* fname, bool read_ahead);
+	int read_whole(size_t size);
+	const unsigned char* read_sync(size_t& len);
+	void recycle(Block& b);
+};
+
+#endif // READAHEAD_H_INCLUDED_
@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "Resolver.h"
+#include "IO.h"
+
+#include <string.h>
+#include <errno.h>
+
+FileResolver& FileResolver::instance()
+{
+	static FileResolver s_instance;
+	return s_instance;
+}
+
+OOBase::LocalString FileResolver::resolve_url(const OOBase::LocalString& strBase, const OOBase::LocalString&, const OOBase::LocalString& strSystemId)
+{
+	OOBase::LocalString path(strBase.get_allocator());
+
+	const char* s = strrchr(strBase.c_str(),'/');
+	int err = 0;
+	if (s)
+		err = path.assign(strBase.c_str(),s - strBase.c_str() + 1);
+	if (err == 0)
+		err = path.append(strSystemId.c_str());
+	if (err != 0)
+		throw "Out of memory";
+
+	return path;
+}
+
+int FileResolver::open(IO& io, const OOBase::LocalString& strURL)
+{
+	return io.open(strURL.c_str());
+}
+
+CatalogResolver::CatalogResolver(OOBase::AllocatorInstance& allocator) :
+		m_allocator(allocator),
+		m_system_ids(allocator),
+		m_public_ids(allocator)
+{
+}
+
+int CatalogResolver::add(const char* szPublicId, const char* szSystemId, const void* buffer, size_t len)
+{
+	if (!szSystemId || *szSystemId == '\0')
+		return EINVAL;
+
+	OOBase::LocalString strSystemId(m_allocator);
+	int err = strSystemId.assign(szSystemId);
+	if (err == 0)
+		err = m_system_ids.insert(strSystemId,Entry(buffer,len));
+
+	if (err == 0 && szPublicId && *szPublicId != '\0')
+	{
+		OOBase::LocalString strPublicId(m_allocator);
+		err = strPublicId.assign(szPublicId);
+		if (err == 0)
+			err = m_public_ids.insert(strPublicId,strSystemId);
+	}
+
+	return err;
+}
+
+OOBase::LocalString CatalogResolver::resolve_url(const OOBase::LocalString& strBase, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId)
+{
+	// Public ids take precedence, as they are location independent
+	if (!strPublicId.empty())
+	{
+		OOBase::HashTable<OOBase::LocalString,OOBase::LocalString,OOBase::AllocatorInstance>::iterator i = m_public_ids.find(strPublicId);
+		if (i != m_public_ids.end())
+		{
+			OOBase::LocalString strURL(strBase.get_allocator());
+			int err = strURL.assign(i->value.c_str(),i->value.length());
+			if (err != 0)
+				throw "Out of memory";
+			return strURL;
+		}
+	}
+
+	if (m_system_ids.find(strSystemId) != m_system_ids.end())
+		return strSystemId;
+
+	// Relative ids may still resolve to a catalog entry
+	return FileResolver::resolve_url(strBase,strPublicId,strSystemId);
+}
+
+int CatalogResolver::open(IO& io, const OOBase::LocalString& strURL)
+{
+	OOBase::HashTable<OOBase::LocalString,Entry,OOBase::AllocatorInstance>::iterator i = m_system_ids.find(strURL);
+	if (i != m_system_ids.end())
+		return io.open(i->value.m_buffer,i->value.m_len);
+
+	return FileResolver::open(io,strURL);
+}
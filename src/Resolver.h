@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef RESOLVER_H_INCLUDED_
+#define RESOLVER_H_INCLUDED_
+
+#include <OOBase/String.h>
+#include <OOBase/HashTable.h>
+
+class IO;
+
+class Resolver
+{
+public:
+	virtual OOBase::LocalString resolve_url(const OOBase::LocalString& strBase, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId) = 0;
+	virtual int open(IO& io, const OOBase::LocalString& strURL) = 0;
+
+protected:
+	Resolver() {}
+	virtual ~Resolver() {}
+
+private:
+	Resolver(const Resolver&);
+	Resolver& operator = (const Resolver&);
+};
+
+// Resolves system ids relative to the base, and reads from the filesystem
+class FileResolver : public Resolver
+{
+public:
+	FileResolver() {}
+	virtual ~FileResolver() {}
+
+	virtual OOBase::LocalString resolve_url(const OOBase::LocalString& strBase, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId);
+	virtual int open(IO& io, const OOBase::LocalString& strURL);
+
+	static FileResolver& instance();
+};
+
+// Serves preloaded buffers by public or system id, falling back to files.
+// Once populated, a catalog may be shared read-only by many Tokenizers.
+class CatalogResolver : public FileResolver
+{
+public:
+	CatalogResolver(OOBase::AllocatorInstance& allocator);
+	virtual ~CatalogResolver() {}
+
+	// The buffer is not copied, it must outlive the catalog
+	int add(const char* szPublicId, const char* szSystemId, const void* buffer, size_t len);
+
+	virtual OOBase::LocalString resolve_url(const OOBase::LocalString& strBase, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId);
+	virtual int open(IO& io, const OOBase::LocalString& strURL);
+
+private:
+	OOBase::AllocatorInstance& m_allocator;
+
+	struct Entry
+	{
+		Entry(const void* buffer, size_t len) :
+			m_buffer(static_cast<const unsigned char*>(buffer)), m_len(len)
+		{}
+
+		const unsigned char* m_buffer;
+		size_t               m_len;
+	};
+	OOBase::HashTable<OOBase::LocalString,Entry,OOBase::AllocatorInstance> m_system_ids;
+	OOBase::HashTable<OOBase::LocalString,OOBase::LocalString,OOBase::AllocatorInstance> m_public_ids;
+};
+
+#endif // RESOLVER_H_INCLUDED_
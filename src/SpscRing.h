@@ -0,0 +1,188 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SPSCRING_H_INCLUDED_
+#define SPSCRING_H_INCLUDED_
+
+#include <OOBase/Condition.h>
+#include <OOBase/Thread.h>
+
+#include <stddef.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Acquire loads and release stores of an index shared between two threads
+inline size_t load_acquire(const volatile size_t& v)
+{
+#if defined(_MSC_VER)
+	size_t r = v;
+	_ReadWriteBarrier();
+	return r;
+#else
+	return __atomic_load_n(&v,__ATOMIC_ACQUIRE);
+#endif
+}
+
+inline void store_release(volatile size_t& v, size_t n)
+{
+#if defined(_MSC_VER)
+	_ReadWriteBarrier();
+	v = n;
+#else
+	__atomic_store_n(&v,n,__ATOMIC_RELEASE);
+#endif
+}
+
+// Orders a store before a later load of a different index
+inline void full_fence()
+{
+#if defined(_MSC_VER)
+	_mm_mfence();
+#else
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+// A lock-free ring of N slots, N a power of 2, for exactly one producer thread and one consumer thread.
+// Slots are filled and drained in place, so T is usually a handle to a reusable buffer.
+// The slot functions never block: a NULL slot means try again later.
+// The wait functions spin briefly, then sleep until the other side publishes or consumes.
+template <typename T, size_t N>
+class SpscRing
+{
+public:
+	static const size_t spin_count = 64;
+
+	SpscRing() : m_head(0), m_tail(0), m_waiting(0)
+	{}
+
+	// Producer: the next slot to fill, or NULL if the ring is full
+	T* producer_slot()
+	{
+		size_t tail = m_tail;
+		if (tail - load_acquire(m_head) == N)
+			return NULL;
+
+		return &m_slots[tail & (N - 1)];
+	}
+
+	// Producer: hands the filled slot to the consumer
+	void publish()
+	{
+		store_release(m_tail,m_tail + 1);
+		signal();
+	}
+
+	// Producer: the next slot to fill, waiting while the ring is full.
+	// Returns NULL once stop is non-zero.
+	T* wait_producer_slot(const volatile size_t& stop)
+	{
+		return wait(&SpscRing::producer_slot,stop);
+	}
+
+	// Consumer: the oldest filled slot, or NULL if the ring is empty
+	T* consumer_slot()
+	{
+		size_t head = m_head;
+		if (head == load_acquire(m_tail))
+			return NULL;
+
+		return &m_slots[head & (N - 1)];
+	}
+
+	// Consumer: hands the drained slot back to the producer
+	void consume()
+	{
+		store_release(m_head,m_head + 1);
+		signal();
+	}
+
+	// Consumer: the oldest filled slot, waiting while the ring is empty.
+	// Returns NULL once the ring is empty and stop is non-zero.
+	T* wait_consumer_slot(const volatile size_t& stop)
+	{
+		return wait(&SpscRing::consumer_slot,stop);
+	}
+
+	// Wakes any waiter, call after setting its stop flag
+	void wake()
+	{
+		OOBase::Guard<OOBase::Condition::Mutex> guard(m_lock);
+		m_cond.broadcast();
+	}
+
+	// Every slot, for allocating and freeing their buffers while no thread is running
+	T& operator [](size_t i)
+	{
+		return m_slots[i];
+	}
+
+private:
+	SpscRing(const SpscRing&);
+	SpscRing& operator = (const SpscRing&);
+
+	// Each index is written by one side only, keep them on separate cache lines
+	volatile size_t m_head;
+	char            m_pad[64 - sizeof(size_t)];
+	volatile size_t m_tail;
+	char            m_pad2[64 - sizeof(size_t)];
+	T               m_slots[N];
+
+	// Only one side can be waiting, the ring cannot be both full and empty
+	volatile size_t          m_waiting;
+	OOBase::Condition::Mutex m_lock;
+	OOBase::Condition        m_cond;
+
+	T* wait(T* (SpscRing::*slot)(), const volatile size_t& stop)
+	{
+		T* s = NULL;
+		for (size_t i = 0;i < spin_count;++i)
+		{
+			if ((s = (this->*slot)()) != NULL || load_acquire(stop))
+				return s;
+
+			OOBase::Thread::yield();
+		}
+
+		OOBase::Guard<OOBase::Condition::Mutex> guard(m_lock);
+
+		// Announce the wait before looking again, signal() stores the index before looking at m_waiting
+		store_release(m_waiting,1);
+		full_fence();
+
+		while (!(s = (this->*slot)()) && !load_acquire(stop))
+			m_cond.wait(m_lock);
+
+		store_release(m_waiting,0);
+		return s;
+	}
+
+	void signal()
+	{
+		full_fence();
+		if (load_acquire(m_waiting))
+			wake();
+	}
+};
+
+#endif // SPSCRING_H_INCLUDED_
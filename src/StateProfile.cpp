@@ -0,0 +1,259 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "StateProfile.h"
+
+#if defined(OOXML_STATE_PROFILE)
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace
+{
+	struct Row
+	{
+		unsigned long long m_count;
+		unsigned long      m_key;
+		size_t             m_machine;
+	};
+
+	int compare_rows(const void* a, const void* b)
+	{
+		const Row* r1 = static_cast<const Row*>(a);
+		const Row* r2 = static_cast<const Row*>(b);
+		if (r1->m_count != r2->m_count)
+			return (r1->m_count > r2->m_count ? -1 : 1);
+		return (r1->m_key < r2->m_key ? -1 : (r1->m_key > r2->m_key ? 1 : 0));
+	}
+}
+
+StateProfile::StateProfile(OOBase::AllocatorInstance& allocator, const Machine* machines) :
+		m_allocator(allocator),
+		m_machines(machines),
+		m_machine_count(0),
+		m_states(NULL),
+		m_state_alloc(0),
+		m_transitions(NULL),
+		m_trans_alloc(0),
+		m_trans_count(0),
+		m_stack(NULL),
+		m_stack_alloc(0),
+		m_top(0),
+		m_current(0),
+		m_prev(-1)
+{
+	while (m_machines[m_machine_count].m_name)
+		++m_machine_count;
+
+	restart();
+}
+
+StateProfile::~StateProfile()
+{
+	m_allocator.free(m_states);
+	m_allocator.free(m_transitions);
+	m_allocator.free(m_stack);
+}
+
+void StateProfile::restart()
+{
+	m_top = 0;
+	m_prev = -1;
+
+	// The first machine is main
+	m_current = 0;
+}
+
+void StateProfile::grow_states(size_t cs)
+{
+	size_t new_alloc = (m_state_alloc ? m_state_alloc * 2 : 256);
+	while (new_alloc <= cs)
+		new_alloc *= 2;
+
+	State* new_states = static_cast<State*>(m_allocator.allocate(new_alloc * sizeof(State),OOBase::alignment_of<State>::value));
+	if (!new_states)
+		throw "Out of memory";
+
+	memset(new_states,0,new_alloc * sizeof(State));
+	if (m_states)
+	{
+		memcpy(new_states,m_states,m_state_alloc * sizeof(State));
+		m_allocator.free(m_states);
+	}
+
+	m_states = new_states;
+	m_state_alloc = new_alloc;
+}
+
+void StateProfile::grow_transitions()
+{
+	size_t new_alloc = (m_trans_alloc ? m_trans_alloc * 2 : 1024);
+	Transition* old = m_transitions;
+	size_t old_alloc = m_trans_alloc;
+
+	m_transitions = static_cast<Transition*>(m_allocator.allocate(new_alloc * sizeof(Transition),OOBase::alignment_of<Transition>::value));
+	if (!m_transitions)
+		throw "Out of memory";
+
+	memset(m_transitions,0,new_alloc * sizeof(Transition));
+	m_trans_alloc = new_alloc;
+
+	for (size_t i = 0;i < old_alloc;++i)
+	{
+		if (old[i].m_key)
+			find_transition(old[i].m_key) = old[i];
+	}
+
+	m_allocator.free(old);
+}
+
+StateProfile::Transition& StateProfile::find_transition(unsigned long key)
+{
+	// Linear probing, the table is never more than half full
+	size_t i = (key * 2654435761UL) & (m_trans_alloc - 1);
+	while (m_transitions[i].m_key && m_transitions[i].m_key != key)
+		i = (i + 1) & (m_trans_alloc - 1);
+
+	return m_transitions[i];
+}
+
+void StateProfile::enter(int cs)
+{
+	for (size_t m = 0;m < m_machine_count;++m)
+	{
+		if (m_machines[m].m_entry == cs)
+		{
+			m_current = m;
+			break;
+		}
+	}
+
+	size_t s = static_cast<size_t>(cs);
+	if (s >= m_state_alloc)
+		grow_states(s);
+
+	++m_states[s].m_count;
+	m_states[s].m_machine = m_current;
+
+	if (m_prev >= 0)
+	{
+		if ((m_trans_count + 1) * 2 > m_trans_alloc)
+			grow_transitions();
+
+		unsigned long key = ((static_cast<unsigned long>(m_prev) << 16) | s) + 1;
+		Transition& t = find_transition(key);
+		if (!t.m_key)
+		{
+			t.m_key = key;
+			t.m_machine = m_current;
+			++m_trans_count;
+		}
+		++t.m_count;
+	}
+
+	m_prev = cs;
+}
+
+void StateProfile::push()
+{
+	if (m_top == m_stack_alloc)
+	{
+		size_t new_alloc = (m_stack_alloc ? m_stack_alloc * 2 : 64);
+		size_t* new_stack = static_cast<size_t*>(m_allocator.reallocate(m_stack,new_alloc * sizeof(size_t),OOBase::alignment_of<size_t>::value));
+		if (!new_stack)
+			throw "Out of memory";
+
+		m_stack = new_stack;
+		m_stack_alloc = new_alloc;
+	}
+
+	m_stack[m_top++] = m_current;
+}
+
+void StateProfile::pop()
+{
+	if (m_top)
+		m_current = m_stack[--m_top];
+}
+
+void StateProfile::dump(FILE* f, size_t top) const
+{
+	size_t rows = (m_state_alloc > m_trans_count ? m_state_alloc : m_trans_count);
+	Row* r = static_cast<Row*>(m_allocator.allocate((rows + 1) * sizeof(Row),OOBase::alignment_of<Row>::value));
+	if (!r)
+		throw "Out of memory";
+
+	// Per machine totals, in declaration order
+	unsigned long long total = 0;
+	for (size_t i = 0;i < m_state_alloc;++i)
+		total += m_states[i].m_count;
+
+	fprintf(f,"%-22s %14s %7s\n","machine","entries","%");
+	for (size_t m = 0;m < m_machine_count;++m)
+	{
+		unsigned long long count = 0;
+		for (size_t i = 0;i < m_state_alloc;++i)
+		{
+			if (m_states[i].m_count && m_states[i].m_machine == m)
+				count += m_states[i].m_count;
+		}
+		if (count)
+			fprintf(f,"%-22s %14llu %6.2f%%\n",m_machines[m].m_name,count,100.0 * count / total);
+	}
+
+	size_t n = 0;
+	for (size_t i = 0;i < m_state_alloc;++i)
+	{
+		if (m_states[i].m_count)
+		{
+			r[n].m_count = m_states[i].m_count;
+			r[n].m_key = i;
+			r[n].m_machine = m_states[i].m_machine;
+			++n;
+		}
+	}
+	qsort(r,n,sizeof(Row),&compare_rows);
+
+	fprintf(f,"\n%-22s %8s %14s %7s\n","machine","state","entries","%");
+	for (size_t i = 0;i < n && i < top;++i)
+		fprintf(f,"%-22s %8lu %14llu %6.2f%%\n",m_machines[r[i].m_machine].m_name,r[i].m_key,r[i].m_count,100.0 * r[i].m_count / total);
+
+	n = 0;
+	for (size_t i = 0;i < m_trans_alloc;++i)
+	{
+		if (m_transitions[i].m_key)
+		{
+			r[n].m_count = m_transitions[i].m_count;
+			r[n].m_key = m_transitions[i].m_key - 1;
+			r[n].m_machine = m_transitions[i].m_machine;
+			++n;
+		}
+	}
+	qsort(r,n,sizeof(Row),&compare_rows);
+
+	fprintf(f,"\n%-22s %17s %14s\n","machine","transition","count");
+	for (size_t i = 0;i < n && i < top;++i)
+		fprintf(f,"%-22s %8lu->%-7lu %14llu\n",m_machines[r[i].m_machine].m_name,r[i].m_key >> 16,r[i].m_key & 0xFFFF,r[i].m_count);
+
+	m_allocator.free(r);
+}
+
+#endif // OOXML_STATE_PROFILE
@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef STATEPROFILE_H_INCLUDED_
+#define STATEPROFILE_H_INCLUDED_
+
+// Ragel state visit histogram, only built with OOXML_STATE_PROFILE
+// (configure --enable-state-profile, which also forces -T0 code generation
+// so the current state is stored on every transition).
+
+#if defined(OOXML_STATE_PROFILE)
+
+#include <OOBase/Memory.h>
+
+#include <stdio.h>
+
+class StateProfile
+{
+public:
+	// A named := machine, by its entry state
+	struct Machine
+	{
+		int         m_entry;
+		const char* m_name;
+	};
+
+	// machines is terminated by a NULL name, and must be static
+	StateProfile(OOBase::AllocatorInstance& allocator, const Machine* machines);
+	~StateProfile();
+
+	// Called with the state reached by every transition
+	void enter(int cs);
+
+	// Track the machine to return to, mirroring the Ragel call stack
+	void push();
+	void pop();
+
+	// Restart at the main machine, keeping the counts
+	void restart();
+
+	void dump(FILE* f, size_t top = 40) const;
+
+private:
+	StateProfile(const StateProfile&);
+	StateProfile& operator = (const StateProfile&);
+
+	struct State
+	{
+		unsigned long long m_count;
+		size_t             m_machine;
+	};
+
+	struct Transition
+	{
+		unsigned long      m_key;   // (from << 16 | to) + 1, 0 is empty
+		unsigned long long m_count;
+		size_t             m_machine;
+	};
+
+	OOBase::AllocatorInstance& m_allocator;
+	const Machine*             m_machines;
+	size_t                     m_machine_count;
+
+	State*      m_states;
+	size_t      m_state_alloc;
+	Transition* m_transitions;
+	size_t      m_trans_alloc;
+	size_t      m_trans_count;
+	size_t*     m_stack;
+	size_t      m_stack_alloc;
+	size_t      m_top;
+	size_t      m_current;
+	int         m_prev;
+
+	void grow_states(size_t cs);
+	void grow_transitions();
+	Transition& find_transition(unsigned long key);
+};
+
+#endif // OOXML_STATE_PROFILE
+
+#endif // STATEPROFILE_H_INCLUDED_
@@ -20,29 +20,59 @@
 ///////////////////////////////////////////////////////////////////////////////////
 
 #include "Token.h"
+#include "ProfilingAllocator.h"
+
+#include <string.h>
 
 Token::Token(OOBase::AllocatorInstance& allocator) :
 		m_allocator(allocator),
-		m_buffer(NULL),
-		m_alloc(0),
+		m_buffer(m_inline),
+		m_alloc(inline_size),
 		m_len(0)
 {
 }
 
 Token::~Token()
 {
-	m_allocator.free(m_buffer);
+	if (m_buffer != m_inline)
+		m_allocator.free(m_buffer);
+}
+
+void Token::grow(size_t extra)
+{
+	OOXML_ALLOC_SCOPE(TokenBuffers);
+
+	size_t new_alloc = m_alloc * 2;
+	if (new_alloc < m_len + extra)
+		new_alloc = m_len + extra;
+
+	unsigned char* new_buffer = NULL;
+	if (m_buffer == m_inline)
+	{
+		new_buffer = static_cast<unsigned char*>(m_allocator.allocate(new_alloc,1));
+		if (new_buffer)
+			memcpy(new_buffer,m_inline,m_len);
+	}
+	else
+		new_buffer = static_cast<unsigned char*>(m_allocator.reallocate(m_buffer,new_alloc,1));
+
+	if (!new_buffer)
+		throw "Out of memory";
+
+	m_alloc = new_alloc;
+	m_buffer = new_buffer;
 }
 
-bool Token::empty() const
+void Token::reserve(size_t len)
 {
-	return (m_len == 0);
+	if (m_len + len > m_alloc)
+		grow(len);
 }
 
 unsigned char Token::pop()
 {
 	unsigned char r = '\0';
-	if (m_len && m_buffer)
+	if (m_len)
 		r = m_buffer[--m_len];
 
 	return r;
@@ -50,41 +80,27 @@ unsigned char Token::pop()
 
 void Token::push(const char* sz)
 {
-	while (*sz != '\0')
-		push(static_cast<unsigned char>(*sz++));
+	append(sz,strlen(sz));
 }
 
-void Token::push(unsigned char c)
+void Token::append(const void* p, size_t len)
 {
-	if (!m_buffer)
-	{
-		m_buffer = static_cast<unsigned char*>(m_allocator.allocate(32,1));
-		if (!m_buffer)
-			throw "Out of memory";
+	reserve(len);
 
-		m_alloc = 32;
-	}
-	else if (m_len + 1 > m_alloc)
-	{
-		unsigned char* new_buffer = static_cast<unsigned char*>(m_allocator.reallocate(m_buffer,m_alloc * 2,1));
-		if (!new_buffer)
-			throw "Out of memory";
-
-		m_alloc *= 2;
-		m_buffer = new_buffer;
-	}
-
-	m_buffer[m_len++] = c;
+	memcpy(m_buffer + m_len,p,len);
+	m_len += len;
 }
 
-void Token::clear()
+const char* Token::pop(size_t& len)
 {
+	len = m_len;
 	m_len = 0;
+	return reinterpret_cast<char*>(m_buffer);
 }
 
-const char* Token::pop(size_t& len)
+const char* Token::pop_c_str()
 {
-	len = m_len;
+	push('\0');
 	m_len = 0;
 	return reinterpret_cast<char*>(m_buffer);
 }
@@ -92,19 +108,39 @@ const char* Token::pop(size_t& len)
 OOBase::LocalString Token::pop_string()
 {
 	OOBase::LocalString str(m_allocator);
+	pop_string(str);
+	return str;
+}
+
+void Token::pop_string(OOBase::LocalString& str)
+{
+	// Assigns into the caller's string, reusing its storage
+	OOXML_ALLOC_SCOPE(Strings);
+
 	size_t len = 0;
 	const char* v = pop(len);
 	int err = str.assign(v,len);
 	if (err != 0)
 		throw "Out of memory";
-	return str;
 }
 
-void Token::rappend(const OOBase::LocalString& str)
+void Token::collapse_spaces()
 {
-	const char* start = str.c_str();
-	const char* end = start + str.length();
-
-	while (end != start)
-		push(*(--end));
+	size_t out = 0;
+	bool space = false;
+	for (size_t i = 0;i < m_len;++i)
+	{
+		unsigned char c = m_buffer[i];
+		// Only #x20, white space from character references is kept
+		if (c == ' ')
+			space = (out > 0);
+		else
+		{
+			if (space)
+				m_buffer[out++] = ' ';
+			space = false;
+			m_buffer[out++] = c;
+		}
+	}
+	m_len = out;
 }
@@ -30,28 +30,64 @@ public:
 	Token(OOBase::AllocatorInstance& allocator);
 	~Token();
 
-	bool empty() const;
+	bool empty() const
+	{
+		return (m_len == 0);
+	}
+
+	size_t length() const
+	{
+		return m_len;
+	}
+
+	// The accumulated bytes, without popping them
+	const char* data() const
+	{
+		return reinterpret_cast<const char*>(m_buffer);
+	}
+
+	void push(unsigned char c)
+	{
+		if (m_len == m_alloc)
+			grow(1);
+
+		m_buffer[m_len++] = c;
+	}
 
-	void push(unsigned char c);
 	void push(const char* sz);
+	void append(const void* p, size_t len);
+	void reserve(size_t len);
 
 	unsigned char pop();
 	const char* pop(size_t& len);
+	const char* pop_c_str();
 	OOBase::LocalString pop_string();
+	void pop_string(OOBase::LocalString& str);
 
-	void clear();
+	// Strips leading and trailing white space, and folds runs of it to a single space
+	void collapse_spaces();
 
-	void rappend(const OOBase::LocalString& str);
+	// Capacity is retained
+	void clear()
+	{
+		m_len = 0;
+	}
 
 private:
 	Token(const Token&);
 	Token& operator = (const Token&);
 
+	void grow(size_t extra);
+
+	// Short names never leave the inline buffer
+	static const size_t inline_size = 32;
+
 	OOBase::AllocatorInstance& m_allocator;
 
 	unsigned char* m_buffer;
 	size_t         m_alloc;
 	size_t         m_len;
+	unsigned char  m_inline[inline_size];
 };
 
 #endif // TOKEN_H_INCLUDED_
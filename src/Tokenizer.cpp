@@ -21,6 +21,9 @@
 
 #include "Tokenizer.h"
 #include "IOState.h"
+#include "ProfilingAllocator.h"
+
+#include <string.h>
 
 Tokenizer::Tokenizer(OOBase::AllocatorInstance& allocator) :
 		m_allocator(allocator),
@@ -29,6 +32,10 @@ Tokenizer::Tokenizer(OOBase::AllocatorInstance& allocator) :
 		m_top(0),
 		m_stacksize(0),
 		m_char('\0'),
+		m_charref(0),
+		m_lean(true),
+		m_suppress(0),
+		m_drop(0),
 		m_token(allocator),
 		m_entity_name(allocator),
 		m_entity(allocator),
@@ -38,39 +45,23 @@ Tokenizer::Tokenizer(OOBase::AllocatorInstance& allocator) :
 		m_standalone(false),
 		m_strEncoding(allocator),
 		m_io(NULL),
-		m_int_param_entities(allocator),
-		m_int_gen_entities(allocator),
-		m_ext_gen_entities(allocator),
-		m_ext_param_entities(allocator)
+		m_resolver(&FileResolver::instance()),
+		m_read_ahead(true),
+		m_entities(allocator),
+		m_shared(NULL),
+		m_dtd(allocator),
+		m_element_offset(0),
+		m_pending(allocator),
+		m_pending_next(0),
+		m_pending_text(allocator),
+		m_skip_depth(0),
+		m_skip_attrs(false),
+		m_content_open(false)
+#if defined(OOXML_STATE_PROFILE)
+		, m_profile(allocator,state_machines())
+		, m_lean_profile(allocator,lean_state_machines())
+#endif
 {
-	struct predef
-	{
-		const char* k;
-		const char* v;
-	};
-
-	static const predef predefined[] =
-	{
-		{"lt", "&#60;" },
-		{"gt", "&#62;" },
-		{"amp", "&#38;" },
-		{"apos", "&#39;" },
-		{"quot", "&#34;" },
-		{NULL,NULL}
-	};
-
-	for (const predef* p = predefined;p->k != NULL;++p)
-	{
-		OOBase::LocalString strKey(m_allocator),strValue(m_allocator);
-		int err = strKey.assign(p->k);
-		if (err == 0)
-			err = strValue.assign(p->v);
-
-		if (err != 0)
-			throw "Out of memory";
-
-		m_int_gen_entities.insert(strKey,InternalEntity(strValue,false));
-	}
 }
 
 Tokenizer::~Tokenizer()
@@ -79,15 +70,19 @@ Tokenizer::~Tokenizer()
 
 	while (m_io)
 		io_pop();
+
+	if (m_shared)
+		m_shared->release();
 }
 
-void Tokenizer::load(const OOBase::LocalString& fname)
+void Tokenizer::reset()
 {
 	while (m_io)
 		io_pop();
 
 	do_init();
-	
+
+	// Everything below keeps its allocated capacity for the next document
 	m_token.clear();
 	m_entity_name.clear();
 	m_entity.clear();
@@ -95,14 +90,77 @@ void Tokenizer::load(const OOBase::LocalString& fname)
 	m_public.clear();
 
 	m_internal_doctype = true;
+	m_standalone = false;
+	m_strEncoding.clear();
+
+	// The shared table is only attached once a DOCTYPE is seen
+	m_entities.reset(NULL);
+
+	m_dtd.reset();
+	m_element_offset = 0;
+	m_pending.clear();
+	m_pending_next = 0;
+	m_pending_text.clear();
+	m_skip_depth = 0;
+	m_skip_attrs = false;
+	m_content_open = false;
+
+	OOXML_COUNT(m_counters.reset());
+
+#if defined(OOXML_STATE_PROFILE)
+	m_profile.restart();
+	m_lean_profile.restart();
+#endif
+}
+
+void Tokenizer::load(const OOBase::LocalString& fname)
+{
+	reset();
 
-	m_io = IOState::create(m_allocator,fname);
+	io_push(IOState::create(m_allocator,*m_resolver,fname,(unsigned int)-1,m_read_ahead));
 
+	OOXML_COUNT(unsigned long long start = clock_ns());
 	m_io->init(m_strEncoding,m_standalone);
+	OOXML_COUNT(m_counters.m_init_ns += clock_ns() - start);
 
 	next_char();
 }
 
+void Tokenizer::set_resolver(Resolver& resolver)
+{
+	m_resolver = &resolver;
+}
+
+void Tokenizer::set_read_ahead(bool read_ahead)
+{
+	m_read_ahead = read_ahead;
+}
+
+void Tokenizer::set_suppress(unsigned int mask)
+{
+	m_suppress = mask;
+	update_drop();
+}
+
+void Tokenizer::update_drop()
+{
+	// The DTD only needs the text of elements, and nothing without a DOCTYPE
+	m_drop = m_suppress & ((1u << Comment) | (1u << PiData) | (1u << CData));
+	if (m_lean)
+		m_drop |= m_suppress & (1u << Text);
+}
+
+void Tokenizer::set_entities(EntityTable* shared)
+{
+	if (shared)
+		shared->addref();
+	if (m_shared)
+		m_shared->release();
+	m_shared = shared;
+
+	m_entities.reset(NULL);
+}
+
 size_t Tokenizer::get_column() const
 {
 	if (m_io)
@@ -127,6 +185,48 @@ unsigned int Tokenizer::get_version() const
 		return 0;
 }
 
+const IOState* Tokenizer::document() const
+{
+	// The document entity is at the bottom of the stack, so elements
+	// from entity expansions report the offset of the reference
+	const IOState* io = m_io;
+	while (io && io->m_next)
+		io = io->m_next;
+
+	return io;
+}
+
+#if defined(OOXML_COUNTERS)
+Counters Tokenizer::get_counters() const
+{
+	// Inputs still open have not been folded in by io_pop() yet
+	Counters counters = m_counters;
+	for (const IOState* io = m_io;io != NULL;io = io->m_next)
+		counters.m_pushback_bytes += io->pushback_bytes();
+
+	return counters;
+}
+#endif
+
+unsigned long long Tokenizer::get_offset() const
+{
+	const IOState* io = document();
+	if (io)
+		return io->get_offset();
+	else
+		return 0;
+}
+
+void Tokenizer::mark_element()
+{
+	// The '<' has already been read, or the ';' of the reference that produced it
+	const IOState* io = document();
+	if (io)
+		m_element_offset = io->get_offset() - io->char_width();
+	else
+		m_element_offset = 0;
+}
+
 OOBase::LocalString Tokenizer::get_location() const
 {
 	if (m_io)
@@ -151,6 +251,12 @@ void Tokenizer::pre_push()
 
 	if (!m_stack)
 		throw "Out of memory";
+
+	OOXML_COUNT(if (m_top + 1 > m_counters.m_stack_max) m_counters.m_stack_max = m_top + 1);
+
+#if defined(OOXML_STATE_PROFILE)
+	profile().push();
+#endif
 }
 
 bool Tokenizer::operator == (const EndOfFile&) const
@@ -163,6 +269,49 @@ bool Tokenizer::operator == (const ParseState& pe) const
 	return (pe.m_halt || m_io == NULL || m_io->is_eof());
 }
 
+// Plain characters of CharData, a state that has read one of them reads the rest without moving:
+// ASCII Chars other than CR, and '<', '&' and ']', which may start markup or ']]>'
+const bool Tokenizer::s_text_run[256] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// Plain characters of AttValue, as for s_text_run, without either quote or the white space normalised to #x20
+const bool Tokenizer::s_value_run[256] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 0, 1, 1, 1, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
 void Tokenizer::next_char()
 {
 	m_char = '\0';
@@ -175,22 +324,39 @@ void Tokenizer::next_char()
 		else
 			break;
 	}
+
+	OOXML_COUNT(if (m_io) ++m_counters.m_bytes);
+}
+
+void Tokenizer::read_run(const bool* plain, bool keep)
+{
+#if !defined(OOXML_STATE_PROFILE)
+	// The histogram counts a visit for every character, so profiled builds read them one at a time
+	size_t n = m_io->read_run(plain,keep ? &m_token : NULL,m_char);
+	OOXML_COUNT(m_counters.m_bytes += n);
+	static_cast<void>(n);
+#else
+	static_cast<void>(plain);
+	static_cast<void>(keep);
+#endif
 }
 
 void Tokenizer::general_entity()
 {
+	OOXML_ALLOC_SCOPE(EntityTables);
+
 	OOBase::LocalString strSysLiteral = m_system.pop_string();
 	if (strSysLiteral.empty())
 	{
 		// Internal general entity
-		int err = m_int_gen_entities.insert(m_entity_name.pop_string(),InternalEntity(m_token.pop_string(),!m_internal_doctype));
+		int err = m_entities.add_internal_general(m_entity_name.pop_string(),m_token.pop_string(),!m_internal_doctype);
 		if (err != 0 && err != EEXIST)
 			throw "Out of memory";
 	}
 	else
 	{
 		// Unparsed entity or external parsed entity
-		int err = m_ext_gen_entities.insert(m_entity_name.pop_string(),ExternalEntity(m_entity.pop_string(),strSysLiteral,m_public.pop_string()));
+		int err = m_entities.add_external_general(m_entity_name.pop_string(),m_entity.pop_string(),strSysLiteral,m_public.pop_string());
 		if (err != 0 && err != EEXIST)
 			throw "Out of memory";
 	}
@@ -198,18 +364,20 @@ void Tokenizer::general_entity()
 
 void Tokenizer::param_entity()
 {
+	OOXML_ALLOC_SCOPE(EntityTables);
+
 	OOBase::LocalString strSysLiteral = m_system.pop_string();
 	if (strSysLiteral.empty())
 	{
 		// Internal parameter entity
-		int err = m_int_param_entities.insert(m_entity_name.pop_string(),m_token.pop_string());
+		int err = m_entities.add_internal_param(m_entity_name.pop_string(),m_token.pop_string());
 		if (err != 0 && err != EEXIST)
 			throw "Out of memory";
 	}
 	else
 	{
 		// External parameter entity
-		int err = m_ext_param_entities.insert(m_entity_name.pop_string(),ExternalEntity(m_public.pop_string(),strSysLiteral));
+		int err = m_entities.add_external_param(m_entity_name.pop_string(),m_public.pop_string(),strSysLiteral);
 		if (err != 0 && err != EEXIST)
 			throw "Out of memory";
 	}
@@ -219,10 +387,11 @@ void Tokenizer::bypass_entity()
 {
 	OOBase::LocalString strEnt = m_entity.pop_string();
 
-	OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance>::iterator i = m_ext_gen_entities.find(strEnt);
-	if (i != m_ext_gen_entities.end())
+	EntityTable::InternalEntity* internal = NULL;
+	EntityTable::ExternalEntity* external = NULL;
+	if (m_entities.find_general(strEnt,internal,external) && external)
 	{
-		if (!i->value.m_strNData.empty())
+		if (!external->m_strNData.empty())
 			throw "Unparsed entity reference in entity value";
 
 		if (m_standalone)
@@ -233,9 +402,7 @@ void Tokenizer::bypass_entity()
 	}
 
 	m_token.push('&');
-	for (const char* sz = strEnt.c_str();*sz != '\0';++sz)
-		m_token.push(*sz);
-
+	m_token.append(strEnt.c_str(),strEnt.length());
 	m_token.push(';');
 }
 
@@ -263,13 +430,21 @@ bool Tokenizer::subst_content_entity()
 
 	IOState* n = NULL;
 
-	OOBase::HashTable<OOBase::LocalString,InternalEntity,OOBase::AllocatorInstance>::iterator internal = m_int_gen_entities.find(strEnt);
-	if (internal != m_int_gen_entities.end())
+	EntityTable::InternalEntity* internal = NULL;
+	EntityTable::ExternalEntity* external = NULL;
+	if (!m_entities.find_general(strEnt,internal,external))
+		throw "WFC: Entity Declared";
+
+	// The caller would fcall the full machine's states from xml_lean's
+	if (m_lean)
+		throw "Entity declared without a DOCTYPE";
+
+	if (internal)
 	{
-		if (m_standalone && internal->value.m_extern_decl)
+		if (m_standalone && internal->m_extern_decl)
 			throw "VC: External in standalone document";
 
-		if (!internal->value.m_strValue.empty())
+		if (!internal->m_strValue.empty())
 		{
 			OOBase::LocalString strFull(m_allocator);
 			int err = strFull.concat("&",strEnt.c_str());
@@ -280,35 +455,31 @@ bool Tokenizer::subst_content_entity()
 
 			check_entity_recurse(strFull);
 
-			n = IOState::create(m_allocator,strFull,get_version(),internal->value.m_strValue);
+			n = IOState::create(m_allocator,strFull,get_version(),internal->m_strValue);
 		}
 	}
 	else
 	{
-		OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance>::iterator external = m_ext_gen_entities.find(strEnt);
-		if (external == m_ext_gen_entities.end())
-			throw "WFC: Entity Declared";
-
 		if (m_standalone) // validity error only
 			throw "VC: External in standalone document";
 
-		if (!external->value.m_strNData.empty())
+		if (!external->m_strNData.empty())
 			throw "WFC: Parsed Entity";
 
-		OOBase::LocalString strExt = resolve_url(get_external_fname(),external->value.m_strPublicId,external->value.m_strSystemId);
+		OOBase::LocalString strExt = m_resolver->resolve_url(get_external_fname(),external->m_strPublicId,external->m_strSystemId);
 
 		check_entity_recurse(strExt);
 
 		// Start pulling from external source
-		n = IOState::create(m_allocator,strExt,get_version());
+		n = IOState::create(m_allocator,*m_resolver,strExt,get_version(),false);
 
-		n->init();
+		io_init(n);
 	}
 
 	if (n)
 	{
-		n->m_next = m_io;
-		m_io = n;
+		io_push(n);
+		OOXML_COUNT(++m_counters.m_entity_expansions);
 	}
 
 	return (n != NULL);
@@ -318,10 +489,12 @@ bool Tokenizer::subst_attr_entity()
 {
 	OOBase::LocalString strEnt = m_entity.pop_string();
 
-	OOBase::HashTable<OOBase::LocalString,InternalEntity,OOBase::AllocatorInstance>::iterator i = m_int_gen_entities.find(strEnt);
-	if (i == m_int_gen_entities.end())
+	EntityTable::InternalEntity* internal = NULL;
+	EntityTable::ExternalEntity* external = NULL;
+	m_entities.find_general(strEnt,internal,external);
+	if (!internal)
 	{
-		if (m_ext_param_entities.find(strEnt) != m_ext_param_entities.end())
+		if (external)
 			throw "WFC: No External Entity References";
 
 		//if (m_standalone)
@@ -331,10 +504,14 @@ bool Tokenizer::subst_attr_entity()
 		//return false;
 	}
 
-	if (m_standalone && i->value.m_extern_decl)
+	// The caller would fcall the full machine's states from xml_lean's
+	if (m_lean)
+		throw "Entity declared without a DOCTYPE";
+
+	if (m_standalone && internal->m_extern_decl)
 		throw "WFC: Entity Declared";
 
-	if (!i->value.m_strValue.empty())
+	if (!internal->m_strValue.empty())
 	{
 		OOBase::LocalString strFull(m_allocator);
 		int err = strFull.concat("&",strEnt.c_str());
@@ -345,13 +522,11 @@ bool Tokenizer::subst_attr_entity()
 
 		check_entity_recurse(strFull);
 
-		IOState* n = IOState::create(m_allocator,strFull,get_version(),i->value.m_strValue);
-
-		n->m_next = m_io;
-		m_io = n;
+		io_push(IOState::create(m_allocator,strFull,get_version(),internal->m_strValue));
+		OOXML_COUNT(++m_counters.m_entity_expansions);
 	}
 
-	return (!i->value.m_strValue.empty());
+	return (!internal->m_strValue.empty());
 }
 
 bool Tokenizer::subst_pentity()
@@ -363,10 +538,14 @@ bool Tokenizer::subst_pentity()
 	if (m_internal_doctype)
 		throw "WFC: PEs in Internal Subset";
 
-	OOBase::HashTable<OOBase::LocalString,OOBase::LocalString,OOBase::AllocatorInstance>::iterator internal = m_int_param_entities.find(strEnt);
-	if (internal != m_int_param_entities.end())
+	OOBase::LocalString* internal = NULL;
+	EntityTable::ExternalEntity* external = NULL;
+	if (!m_entities.find_param(strEnt,internal,external))
+		throw "Unrecognized entity";
+
+	if (internal)
 	{
-		if (!internal->value.empty())
+		if (!internal->empty())
 		{
 			OOBase::LocalString strFull(m_allocator);
 			int err = strFull.concat("%",strEnt.c_str());
@@ -377,29 +556,25 @@ bool Tokenizer::subst_pentity()
 
 			check_entity_recurse(strFull);
 
-			n = IOState::create(m_allocator,strFull,get_version(),internal->value);
+			n = IOState::create(m_allocator,strFull,get_version(),*internal);
 		}
 	}
 	else
 	{
-		OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance>::iterator external = m_ext_param_entities.find(strEnt);
-		if (external == m_ext_param_entities.end())
-			throw "Unrecognized entity";
-
-		OOBase::LocalString strExt = resolve_url(get_external_fname(),external->value.m_strPublicId,external->value.m_strSystemId);
+		OOBase::LocalString strExt = m_resolver->resolve_url(get_external_fname(),external->m_strPublicId,external->m_strSystemId);
 
 		check_entity_recurse(strExt);
 
 		// Start pulling from external source
-		n = IOState::create(m_allocator,strExt,get_version());
+		n = IOState::create(m_allocator,*m_resolver,strExt,get_version(),false);
 
-		n->init();
+		io_init(n);
 	}
 
 	if (n)
 	{
-		n->m_next = m_io;
-		m_io = n;
+		io_push(n);
+		OOXML_COUNT(++m_counters.m_entity_expansions);
 	}
 
 	return (n != NULL);
@@ -411,8 +586,12 @@ void Tokenizer::include_pe(bool auto_pop)
 
 	IOState* n = NULL;
 
-	OOBase::HashTable<OOBase::LocalString,OOBase::LocalString,OOBase::AllocatorInstance>::iterator internal = m_int_param_entities.find(strEnt);
-	if (internal != m_int_param_entities.end())
+	OOBase::LocalString* internal = NULL;
+	EntityTable::ExternalEntity* external = NULL;
+	if (!m_entities.find_param(strEnt,internal,external))
+		throw "Unrecognized entity";
+
+	if (internal)
 	{
 		OOBase::LocalString strFull(m_allocator);
 		int err = strFull.concat("%",strEnt.c_str());
@@ -423,24 +602,20 @@ void Tokenizer::include_pe(bool auto_pop)
 
 		check_entity_recurse(strFull);
 
-		n = IOState::create(m_allocator,strFull,get_version(),internal->value);
+		n = IOState::create(m_allocator,strFull,get_version(),*internal);
 
 		n->m_auto_pop = auto_pop;
 	}
 	else
 	{
-		OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance>::iterator external = m_ext_param_entities.find(strEnt);
-		if (external == m_ext_param_entities.end())
-			throw "Unrecognized entity";
-
-		OOBase::LocalString strExt = resolve_url(get_external_fname(),external->value.m_strPublicId,external->value.m_strSystemId);
+		OOBase::LocalString strExt = m_resolver->resolve_url(get_external_fname(),external->m_strPublicId,external->m_strSystemId);
 
 		check_entity_recurse(strExt);
 
 		// Start pulling from external source
-		n = IOState::create(m_allocator,strExt,get_version());
+		n = IOState::create(m_allocator,*m_resolver,strExt,get_version(),false);
 
-		n->init();
+		io_init(n);
 		n->m_auto_pop = auto_pop;
 	}
 
@@ -452,14 +627,15 @@ void Tokenizer::include_pe(bool auto_pop)
 
 		// And one leading space
 		n->push(' ');
-		n->m_next = m_io;
-		m_io = n;
+		io_push(n);
+		OOXML_COUNT(++m_counters.m_entity_expansions);
 	}
 }
 
-void Tokenizer::subst_char(int base)
+void Tokenizer::subst_char()
 {
-	unsigned long v = strtoul(m_entity.pop_string().c_str(),NULL,base);
+	// m_charref saturates above 0x10FFFF, so overflow cannot wrap into range
+	unsigned long v = m_charref;
 
 	// Check for Char
 	if (get_version() == 1)
@@ -503,33 +679,208 @@ void Tokenizer::subst_char(int base)
 	}
 }
 
+namespace
+{
+	bool is_space(const char* p, size_t len)
+	{
+		for (const char* end = p + len;p != end;++p)
+		{
+			if (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+				return false;
+		}
+		return true;
+	}
+}
+
 void Tokenizer::set_token(ParseState& pe, enum TokenType type, size_t offset, bool allow_empty)
 {
+	OOXML_ALLOC_SCOPE(Strings);
+
+	if (type == AttributeValue && m_dtd.att_tokenized())
+		m_token.collapse_spaces();
+
 	size_t len = 0;
 	const char* tok = m_token.pop(len);
 
 	if (offset > len)
 		offset = len;
 
+	m_content_open = false;
+	if (m_skip_depth)
+	{
+		// Only the DTD sees the tokens of a skipped element
+		if (allow_empty || len > offset)
+		{
+			validate(type,tok,len - offset);
+
+			if (type == ElementStart)
+				++m_skip_depth;
+			else if (type == ElementEnd)
+				--m_skip_depth;
+
+			// The element's end, or one of its own attributes for skip_content()
+			if (!m_skip_depth || (m_skip_attrs && m_skip_depth == 1 && (type == AttributeName || type == AttributeValue)))
+			{
+				int err = pe.m_strToken.assign(tok,len - offset);
+				if (err != 0)
+					throw "Out of memory";
+
+				if (m_pending_next < m_pending.size())
+				{
+					// Defaulted attributes go out first
+					queue_token(type,tok,len - offset);
+					type = pop_pending(pe.m_strToken);
+				}
+
+				pe.m_type = type;
+				pe.m_halt = true;
+			}
+		}
+		return;
+	}
+
+	if ((m_suppress & (1u << type)) || (type == Text && (m_suppress & WhitespaceText) && is_space(tok + offset,len - offset)))
+	{
+		// Not returned, but still validated
+		if (allow_empty || len > offset)
+			validate(type,tok,len - offset);
+		return;
+	}
+
 	int err = pe.m_strToken.assign(tok,len - offset);
 	if (err != 0)
 		throw "Out of memory";
 
 	if (allow_empty || len > offset)
 	{
+		validate(type,tok,len - offset);
+
+		OOXML_COUNT(++m_counters.m_tokens[type]);
+
+		if (m_pending_next < m_pending.size())
+		{
+			// Defaulted attributes go out first
+			queue_token(type,tok,len - offset);
+			type = pop_pending(pe.m_strToken);
+		}
+
 		pe.m_type = type;
 		pe.m_halt = true;
 	}
 }
 
+void Tokenizer::validate(TokenType type, const char* tok, size_t len)
+{
+	switch (type)
+	{
+	case DocTypeStart:
+		m_dtd.doctype(tok,len);
+		break;
+	case ElementStart:
+		m_dtd.element_start(tok,len,m_element_offset);
+		break;
+	case ElementEnd:
+		m_dtd.element_end();
+		break;
+	case AttributeName:
+		m_dtd.attribute_name(tok,len);
+		break;
+	case AttributeValue:
+		m_dtd.attribute_value(tok,len);
+		break;
+	case Text:
+		m_dtd.text(tok,len);
+		break;
+	case CData:
+		m_dtd.cdata();
+		break;
+	case Comment:
+	case PiData:
+		m_dtd.markup();
+		break;
+	default:
+		break;
+	}
+}
+
+void Tokenizer::queue_token(TokenType type, const char* tok, size_t len)
+{
+	Pending p = { type, m_pending_text.length(), len };
+	m_pending_text.append(tok,len);
+
+	if (m_pending.push_back(p) != 0)
+		throw "Out of memory";
+}
+
+Tokenizer::TokenType Tokenizer::pop_pending(OOBase::LocalString& strToken)
+{
+	const Pending& p = m_pending[m_pending_next++];
+	TokenType type = p.m_type;
+
+	int err = strToken.assign(m_pending_text.data() + p.m_offset,p.m_len);
+	if (err != 0)
+		throw "Out of memory";
+
+	if (m_pending_next == m_pending.size())
+	{
+		m_pending.clear();
+		m_pending_next = 0;
+		m_pending_text.clear();
+	}
+
+	return type;
+}
+
+void Tokenizer::attr_defaults()
+{
+	m_dtd.attributes_end();
+
+	// Nobody would see them, skip_content() only returns the skipped element's own
+	if (m_skip_depth > 1 || (m_skip_depth && !m_skip_attrs))
+		return;
+
+	const char* name = NULL;
+	const char* value = NULL;
+	size_t len = 0;
+	for (size_t i = m_dtd.first_default();m_dtd.next_default(i,name,value,len);)
+	{
+		queue_token(AttributeName,name,strlen(name));
+		queue_token(AttributeValue,value,len);
+
+		OOXML_COUNT(++m_counters.m_tokens[AttributeName]);
+		OOXML_COUNT(++m_counters.m_tokens[AttributeValue]);
+	}
+}
+
+void Tokenizer::start_content()
+{
+	attr_defaults();
+	m_content_open = true;
+
+	// The rest of the start tag being skipped has been read
+	if (m_skip_depth == 1)
+		scan_content(false);
+}
+
+void Tokenizer::scan_content(bool started)
+{
+	// Only a document without a DOCTYPE, outside any entity, can be scanned raw
+	if (!m_lean || !m_io || m_io->m_next)
+		return;
+
+	// If the content has started, its first character has been read already
+	if (m_io->skip_content(started ? m_char : '\0') && started)
+		next_char();
+}
+
 void Tokenizer::external_doctype()
 {
 	// We cheat and use m_next here
-	m_io->m_next = IOState::create(m_allocator,resolve_url(m_io->m_fname,m_public.pop_string(),m_system.pop_string()),get_version());
+	m_io->m_next = IOState::create(m_allocator,*m_resolver,m_resolver->resolve_url(m_io->m_fname,m_public.pop_string(),m_system.pop_string()),get_version(),false);
 	if (!m_io->m_next)
 		throw "Out of memory";
 
-	m_io->m_next->init();
+	io_init(m_io->m_next);
 }
 
 bool Tokenizer::do_doctype()
@@ -539,8 +890,7 @@ bool Tokenizer::do_doctype()
 	{
 		IOState* n = m_io->m_next;
 		m_io->m_next = NULL;
-		n->m_next = m_io;
-		m_io = n;
+		io_push(n);
 
 		m_internal_doctype = false;
 
@@ -550,6 +900,22 @@ bool Tokenizer::do_doctype()
 	return false;
 }
 
+void Tokenizer::io_init(IOState* n)
+{
+	OOXML_COUNT(unsigned long long start = clock_ns());
+	n->init();
+	OOXML_COUNT(m_counters.m_init_ns += clock_ns() - start);
+}
+
+void Tokenizer::io_push(IOState* n)
+{
+	n->m_next = m_io;
+	m_io = n;
+
+	OOXML_COUNT(++m_counters.m_io_pushes);
+	OOXML_COUNT(if (++m_counters.m_io_depth > m_counters.m_io_max_depth) m_counters.m_io_max_depth = m_counters.m_io_depth);
+}
+
 void Tokenizer::io_pop()
 {
 	if (m_io)
@@ -557,6 +923,11 @@ void Tokenizer::io_pop()
 		IOState* n = m_io;
 		m_io = m_io->m_next;
 		n->m_next = NULL;
+
+		OOXML_COUNT(++m_counters.m_io_pops);
+		OOXML_COUNT(--m_counters.m_io_depth);
+		OOXML_COUNT(m_counters.m_pushback_bytes += n->pushback_bytes());
+
 		n->destroy();
 	}
 }
@@ -23,16 +23,17 @@
 #define TOKENIZER_H_INCLUDED_
 
 #include <OOBase/String.h>
-#include <OOBase/HashTable.h>
+#include <OOBase/Vector.h>
 
 #include "Token.h"
+#include "Resolver.h"
+#include "Counters.h"
+#include "DTD.h"
+#include "EntityTable.h"
+#include "StateProfile.h"
 
 class IOState;
 
-// Callbacks
-
-OOBase::LocalString resolve_url(const OOBase::LocalString& strBase, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId);
-
 class Tokenizer
 {
 public:
@@ -41,6 +42,31 @@ public:
 	
 	void load(const OOBase::LocalString& fname);
 
+	// Returns to a clean state, retaining all allocated capacity
+	void reset();
+
+	// The resolver is not owned, and must outlive the Tokenizer
+	void set_resolver(Resolver& resolver);
+
+	// Whether documents are read ahead on another thread, see ReadAhead. On by default,
+	// external entities are always read on the calling thread
+	void set_read_ahead(bool read_ahead);
+
+	// Entities the next document does not declare itself are looked for in the shared
+	// table, which may be NULL, once the document has a DOCTYPE.
+	// The Tokenizer holds a reference until it is replaced.
+	void set_entities(EntityTable* shared);
+
+	// The entities declared by the last document, over any shared table, as a new shared table
+	EntityTable* share_entities(OOBase::AllocatorInstance& allocator)
+	{
+		// Without a DOCTYPE nothing was declared over the shared table
+		if (m_lean && m_shared)
+			return m_shared->addref();
+
+		return m_entities.share(allocator);
+	}
+
 	enum TokenType
 	{
 		Error = 0,
@@ -59,16 +85,67 @@ public:
 	};
 
 	TokenType next_token(OOBase::LocalString& strToken, int verbose = 0);
+
+	// Token types not to return, as a mask of (1 << type), with WhitespaceText for Text that
+	// is only white space. Suppressed text is not accumulated, unless a DTD needs to see it.
+	// PiTarget is never returned, the target is the start of PiData.
+	static const unsigned int WhitespaceText = 1 << 13;
+	void set_suppress(unsigned int mask);
+
+	// Call within an element, after its ElementStart, an attribute or a token of its content,
+	// to pass over the rest of it without producing its tokens. Returns ElementEnd, or Error.
+	// Without a DOCTYPE the content is scanned raw for the matching end tag, and is not checked.
+	TokenType skip_element(int verbose = 0);
+
+	// As skip_element(), but called after ElementStart or an attribute, the element's
+	// remaining attributes are returned first
+	TokenType skip_content(OOBase::LocalString& strToken, int verbose = 0);
 	size_t get_column() const;
 	size_t get_line() const;
 	OOBase::LocalString get_location() const;
 	unsigned int get_version() const;
 
+	// Bytes read from the document entity, see IOState::get_offset()
+	unsigned long long get_offset() const;
+
 	OOBase::AllocatorInstance& get_allocator() const
 	{
 		return m_allocator;
 	}
 
+	// Validity against the DTD, complete once End has been returned
+	bool is_valid() const
+	{
+		return m_dtd.is_valid();
+	}
+
+	const OOBase::LocalString& get_validity_error() const
+	{
+		return m_dtd.error();
+	}
+
+	// The ordinal and start tag offset of the element with an ID, once it has been parsed
+	bool find_id(const OOBase::LocalString& strId, size_t& element, unsigned long long& offset) const
+	{
+		return m_dtd.find_id(strId.c_str(),strId.length(),element,offset);
+	}
+
+#if defined(OOXML_COUNTERS)
+	// Accumulated since the last load() or reset()
+	Counters get_counters() const;
+#endif
+
+#if defined(OOXML_STATE_PROFILE)
+	// Accumulated over the lifetime of the Tokenizer
+	void dump_state_profile(FILE* f) const
+	{
+		fprintf(f,"Content-only machine:\n");
+		m_lean_profile.dump(f);
+		fprintf(f,"\nFull machine:\n");
+		m_profile.dump(f);
+	}
+#endif
+
 private:
 	OOBase::AllocatorInstance& m_allocator;
 
@@ -79,6 +156,11 @@ private:
 	
 	size_t        m_stacksize;
 	unsigned char m_char;
+	unsigned long m_charref;
+	bool          m_lean;     // Running the content-only machine
+
+	unsigned int  m_suppress;
+	unsigned int  m_drop;     // Types whose characters are not accumulated
 
 	Token m_token;
 	Token m_entity_name;
@@ -89,41 +171,56 @@ private:
 	bool  m_standalone;
 	OOBase::LocalString m_strEncoding;
 
-	IOState* m_io;
+	IOState*  m_io;
+	Resolver* m_resolver;
+	bool      m_read_ahead;
 
-	OOBase::HashTable<OOBase::LocalString,OOBase::LocalString,OOBase::AllocatorInstance> m_int_param_entities;
+#if defined(OOXML_COUNTERS)
+	Counters m_counters;
+#endif
 
-	struct InternalEntity
-	{
-		InternalEntity(const OOBase::LocalString& strValue, bool extern_decl) :
-			m_strValue(strValue), m_extern_decl(extern_decl)
-		{}
+	// This document's declarations, over the shared table if any
+	EntityTable  m_entities;
+	EntityTable* m_shared;
 
-		OOBase::LocalString m_strValue;
-		bool                m_extern_decl;
-	};
-	OOBase::HashTable<OOBase::LocalString,InternalEntity,OOBase::AllocatorInstance> m_int_gen_entities;
+	DTD                m_dtd;
+	unsigned long long m_element_offset;
 
-	struct ExternalEntity
+	struct Pending
 	{
-		ExternalEntity(const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId, const OOBase::LocalString& strNData) :
-			m_strPublicId(strPublicId), m_strSystemId(strSystemId), m_strNData(strNData)
-		{}
+		TokenType m_type;
+		size_t    m_offset;
+		size_t    m_len;
+	};
+	OOBase::Vector<Pending,OOBase::AllocatorInstance> m_pending;
+	size_t m_pending_next;
+	Token  m_pending_text;
 
-		ExternalEntity(const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId) :
-			m_strPublicId(strPublicId), m_strSystemId(strSystemId), m_strNData(strSystemId.get_allocator())
-		{}
+	// Open elements left to pass over, see skip_element()
+	size_t m_skip_depth;
+	bool   m_skip_attrs;     // Return the skipped element's own attributes
+	bool   m_content_open;   // The last token was an ElementStart followed by '>'
 
-		OOBase::LocalString m_strPublicId;
-		OOBase::LocalString m_strSystemId;
-		OOBase::LocalString m_strNData;
-	};
-	OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance> m_ext_gen_entities;
-	OOBase::HashTable<OOBase::LocalString,ExternalEntity,OOBase::AllocatorInstance> m_ext_param_entities;
+#if defined(OOXML_STATE_PROFILE)
+	StateProfile m_profile;
+	StateProfile m_lean_profile;
+
+	static const StateProfile::Machine* state_machines();
+	static const StateProfile::Machine* lean_state_machines();
+
+	StateProfile& profile()
+	{
+		return (m_lean ? m_lean_profile : m_profile);
+	}
+#endif
 		
 	// These are the private members used by Ragel
 	Tokenizer& operator ++ ()
 	{ 
+#if defined(OOXML_STATE_PROFILE)
+		// Only valid with -T0, -G2 does not store m_cs until it exits
+		profile().enter(m_cs);
+#endif
 		next_char();
 		return *this;
 	}
@@ -157,13 +254,56 @@ private:
 	
 	void pre_push();
 
+	void post_pop()
+	{
+#if defined(OOXML_STATE_PROFILE)
+		profile().pop();
+#endif
+	}
+
 	void external_doctype();
 	bool do_doctype();
 
 	void do_init();
+	void exec_lean(ParseState& pe);
+	void exec_full(ParseState& pe);
 
 	void next_char();
+	void update_drop();
+
+	void append(TokenType type)
+	{
+		if (!(m_drop & (1u << type)))
+			m_token.push(m_char);
+	}
+
+	// A plain character is followed by the rest of its run in one go, see s_text_run
+	void append_text()
+	{
+		append(Tokenizer::Text);
+		if (s_text_run[m_char] && m_io)
+			read_run(s_text_run,!(m_drop & (1u << Tokenizer::Text)));
+	}
+
+	void append_value()
+	{
+		m_token.push(m_char);
+		if (s_value_run[m_char] && m_io)
+			read_run(s_value_run,true);
+	}
+
+	static const bool s_text_run[256];
+	static const bool s_value_run[256];
+	void read_run(const bool* plain, bool keep);
+
 	void set_token(ParseState& pe, enum TokenType type, size_t offset = 0, bool allow_empty = true);
+	void validate(TokenType type, const char* tok, size_t len);
+	void queue_token(TokenType type, const char* tok, size_t len);
+	TokenType pop_pending(OOBase::LocalString& strToken);
+	void attr_defaults();
+	void start_content();
+	void scan_content(bool started);
+	TokenType skip(OOBase::LocalString& strToken, bool attrs, int verbose);
 	OOBase::LocalString get_external_fname() const;
 	void bypass_entity();
 	void check_entity_recurse(const OOBase::LocalString& strEnt);
@@ -173,8 +313,58 @@ private:
 	bool subst_content_entity();
 	bool subst_pentity();
 	void include_pe(bool auto_pop);
+	void io_init(IOState* n);
+	void io_push(IOState* n);
 	void io_pop();
-	void subst_char(int base);
+	void subst_char();
+
+	const IOState* document() const;
+	void mark_element();
+
+	void cm_element()
+	{
+		size_t len = 0;
+		const char* name = m_token.pop(len);
+		m_dtd.cm_element(name,len);
+	}
+
+	void cm_name()
+	{
+		size_t len = 0;
+		const char* name = m_token.pop(len);
+		m_dtd.cm_name(name,len);
+	}
+
+	void att_element()
+	{
+		size_t len = 0;
+		const char* name = m_token.pop(len);
+		m_dtd.att_element(name,len);
+	}
+
+	void att_name()
+	{
+		size_t len = 0;
+		const char* name = m_token.pop(len);
+		m_dtd.att_name(name,len);
+	}
+
+	void att_def()
+	{
+		if (m_dtd.att_decl_tokenized())
+			m_token.collapse_spaces();
+
+		size_t len = 0;
+		const char* value = m_token.pop(len);
+		m_dtd.att_def(value,len);
+	}
+
+	void predef_char(unsigned char c)
+	{
+		// The entity name has been partially accumulated as a possible general entity
+		m_entity.clear();
+		m_token.push(c);
+	}
 };
 
 #endif // TOKENIZER_H_INCLUDED_
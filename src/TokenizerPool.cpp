@@ -0,0 +1,83 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#include "TokenizerPool.h"
+#include "Resolver.h"
+
+TokenizerPool::TokenizerPool(OOBase::AllocatorInstance& allocator, size_t max_idle) :
+		m_allocator(allocator),
+		m_max_idle(max_idle),
+		m_idle(allocator)
+{
+}
+
+TokenizerPool::~TokenizerPool()
+{
+	Tokenizer* tok = NULL;
+	while (m_idle.pop_back(&tok))
+		destroy(tok);
+}
+
+Tokenizer* TokenizerPool::acquire()
+{
+	Tokenizer* tok = NULL;
+	{
+		OOBase::Guard<OOBase::SpinLock> guard(m_lock);
+
+		if (m_idle.pop_back(&tok))
+			return tok;
+	}
+
+	void* p = m_allocator.allocate(sizeof(Tokenizer),OOBase::alignment_of<Tokenizer>::value);
+	if (!p)
+		throw "Out of memory";
+
+	return ::new (p) Tokenizer(m_allocator);
+}
+
+void TokenizerPool::release(Tokenizer* tok)
+{
+	if (!tok)
+		return;
+
+	// Drop any open input and entity declarations outside the lock,
+	// and put back the settings a new Tokenizer has
+	tok->reset();
+	tok->set_resolver(FileResolver::instance());
+	tok->set_read_ahead(true);
+	tok->set_suppress(0);
+	tok->set_entities(NULL);
+
+	{
+		OOBase::Guard<OOBase::SpinLock> guard(m_lock);
+
+		if (m_idle.size() < m_max_idle && m_idle.push_back(tok) == 0)
+			return;
+	}
+
+	destroy(tok);
+}
+
+void TokenizerPool::destroy(Tokenizer* tok)
+{
+	tok->~Tokenizer();
+	m_allocator.free(tok);
+}
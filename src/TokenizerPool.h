@@ -0,0 +1,54 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+#ifndef TOKENIZERPOOL_H_INCLUDED_
+#define TOKENIZERPOOL_H_INCLUDED_
+
+#include <OOBase/Mutex.h>
+#include <OOBase/Vector.h>
+
+#include "Tokenizer.h"
+
+// A thread-safe cache of ready Tokenizers.
+// The allocator is shared by every pooled Tokenizer, so must be thread-safe
+class TokenizerPool
+{
+public:
+	TokenizerPool(OOBase::AllocatorInstance& allocator, size_t max_idle = 64);
+	~TokenizerPool();
+
+	Tokenizer* acquire();
+	void release(Tokenizer* tok);
+
+private:
+	TokenizerPool(const TokenizerPool&);
+	TokenizerPool& operator = (const TokenizerPool&);
+
+	OOBase::AllocatorInstance& m_allocator;
+	size_t                     m_max_idle;
+
+	OOBase::SpinLock                                     m_lock;
+	OOBase::Vector<Tokenizer*,OOBase::AllocatorInstance> m_idle;
+
+	void destroy(Tokenizer* tok);
+};
+
+#endif // TOKENIZERPOOL_H_INCLUDED_
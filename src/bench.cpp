@@ -0,0 +1,225 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+// Throughput harness for Tokenizer::next_token over a corpus of files
+
+#include "Tokenizer.h"
+#include "Pipeline.h"
+#include "Clock.h"
+#include "ProfilingAllocator.h"
+
+#include <OOBase/ArenaAllocator.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace
+{
+	struct Result
+	{
+		unsigned long long m_tokens;
+		unsigned long long m_allocs;
+		unsigned long long m_ns;
+		bool               m_ok;
+	};
+
+	Result parse_pipelined(const char* fname)
+	{
+		Result res = { 0, 0, 0, false };
+
+		// Only the consumer's allocations are counted, the tokenizer thread has its own arena
+		OOBase::ArenaAllocator arena;
+		ProfilingAllocator allocator(arena);
+		{
+			OOBase::LocalString strToken(allocator);
+
+			unsigned long long start = clock_ns();
+
+			Pipeline pipeline(allocator);
+			pipeline.start(fname);
+
+			Tokenizer::TokenType type;
+			do
+			{
+				type = pipeline.next_token(strToken);
+				++res.m_tokens;
+			}
+			while (type != Tokenizer::End && type != Tokenizer::Error);
+
+			res.m_ns = clock_ns() - start;
+			res.m_ok = (type == Tokenizer::End);
+
+			if (!res.m_ok)
+				fprintf(stderr,"%s: %s\n",fname,strToken.c_str());
+		}
+		res.m_allocs = allocator.count();
+
+		return res;
+	}
+
+	Result parse_once(const char* fname, bool pipelined, bool report = false, bool counters = false, bool states = false)
+	{
+		if (pipelined)
+			return parse_pipelined(fname);
+
+		Result res = { 0, 0, 0, false };
+
+		OOBase::ArenaAllocator arena;
+		ProfilingAllocator allocator(arena);
+		{
+			OOBase::LocalString strFile(allocator),strToken(allocator);
+			if (strFile.assign(fname) != 0)
+				return res;
+
+			unsigned long long start = clock_ns();
+
+			Tokenizer tok(allocator);
+			tok.load(strFile);
+
+			Tokenizer::TokenType type;
+			do
+			{
+				type = tok.next_token(strToken);
+				++res.m_tokens;
+			}
+			while (type != Tokenizer::End && type != Tokenizer::Error);
+
+			res.m_ns = clock_ns() - start;
+			res.m_ok = (type == Tokenizer::End);
+
+			if (!res.m_ok)
+				fprintf(stderr,"%s: syntax error at line %lu, col %lu\n",fname,(unsigned long)tok.get_line(),(unsigned long)tok.get_column());
+
+#if defined(OOXML_COUNTERS)
+			if (counters)
+				tok.get_counters().report(stdout);
+#else
+			(void)counters;
+#endif
+
+#if defined(OOXML_STATE_PROFILE)
+			if (states)
+				tok.dump_state_profile(stdout);
+#else
+			(void)states;
+#endif
+		}
+		res.m_allocs = allocator.count();
+
+		if (report)
+			allocator.report(stdout);
+
+		return res;
+	}
+
+	unsigned long long file_size(const char* fname)
+	{
+		unsigned long long len = 0;
+		FILE* f = fopen(fname,"rb");
+		if (f)
+		{
+			if (fseek(f,0,SEEK_END) == 0)
+				len = static_cast<unsigned long long>(ftell(f));
+			fclose(f);
+		}
+		return len;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int iterations = 5;
+	bool report = false;
+	bool counters = false;
+	bool states = false;
+	bool pipelined = false;
+	int arg = 1;
+	for (;arg < argc && argv[arg][0] == '-';++arg)
+	{
+		if (strcmp(argv[arg],"-a") == 0)
+			report = true;
+		else if (strcmp(argv[arg],"-c") == 0)
+			counters = true;
+		else if (strcmp(argv[arg],"-s") == 0)
+			states = true;
+		else if (strcmp(argv[arg],"-p") == 0)
+			pipelined = true;
+		else if (strcmp(argv[arg],"-n") == 0 && arg + 1 < argc)
+			iterations = static_cast<unsigned int>(atoi(argv[++arg]));
+		else
+			break;
+	}
+
+	if (arg >= argc || iterations == 0)
+	{
+		fprintf(stderr,"Usage: %s [-n iterations] [-a] [-c] [-s] [-p] file...\n  -a  Print an allocation report per file\n  -c  Print the hot-path counters per file (needs --enable-counters)\n  -s  Print the Ragel state histogram per file (needs --enable-state-profile)\n  -p  Read, tokenize and consume on three threads with a Pipeline\n",argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%-32s %12s %10s %12s %10s %12s\n","file","bytes","MB/s","tokens/s","ns/token","allocs/MB");
+
+	int ret = EXIT_SUCCESS;
+	for (;arg < argc;++arg)
+	{
+		const char* fname = argv[arg];
+		unsigned long long bytes = file_size(fname);
+
+		// Warm the page cache, and check the file parses at all
+		Result res = parse_once(fname,pipelined);
+		if (!res.m_ok)
+		{
+			ret = EXIT_FAILURE;
+			continue;
+		}
+
+		// Report the best run, the least disturbed by the rest of the system
+		for (unsigned int i = 0;i < iterations;++i)
+		{
+			Result r = parse_once(fname,pipelined);
+			if (r.m_ns < res.m_ns)
+				res = r;
+		}
+
+		const char* name = strrchr(fname,'/');
+		name = (name ? name + 1 : fname);
+
+		double secs = static_cast<double>(res.m_ns ? res.m_ns : 1) / 1e9;
+		double mb = static_cast<double>(bytes) / (1024.0 * 1024.0);
+
+		printf("%-32s %12llu %10.2f %12.0f %10.1f %12.1f\n",
+				name,
+				bytes,
+				mb / secs,
+				static_cast<double>(res.m_tokens) / secs,
+				static_cast<double>(res.m_ns) / static_cast<double>(res.m_tokens),
+				mb > 0.0 ? static_cast<double>(res.m_allocs) / mb : 0.0);
+
+		// Allocation counts are deterministic, so any run will do
+		if (report || counters || states)
+		{
+			parse_once(fname,false,report,counters,states);
+			printf("\n");
+		}
+	}
+
+	return ret;
+}
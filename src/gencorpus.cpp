@@ -0,0 +1,371 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+// Deterministic synthetic corpus generator for the benchmark harness.
+// The same shape and size always produce byte-identical output.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+namespace
+{
+	class Writer
+	{
+	public:
+		Writer(FILE* f, bool utf16) : m_f(f), m_utf16(utf16), m_written(0)
+		{
+			if (m_utf16)
+			{
+				static const unsigned char bom[2] = { 0xFF, 0xFE };
+				write(bom,2);
+			}
+		}
+
+		unsigned long long written() const
+		{
+			return m_written;
+		}
+
+		void put(const char* sz)
+		{
+			put(sz,strlen(sz));
+		}
+
+		void put(const char* p, size_t len)
+		{
+			if (!m_utf16)
+				write(p,len);
+			else
+			{
+				// The corpus is ASCII, so UTF-16LE is just a zero high byte
+				unsigned char buf[512];
+				while (len)
+				{
+					size_t i = 0;
+					for (;len && i < sizeof(buf);--len)
+					{
+						buf[i++] = static_cast<unsigned char>(*p++);
+						buf[i++] = 0;
+					}
+					write(buf,i);
+				}
+			}
+		}
+
+		void format(const char* fmt, ...)
+		{
+			char buf[1024];
+			va_list args;
+			va_start(args,fmt);
+			int len = vsnprintf(buf,sizeof(buf),fmt,args);
+			va_end(args);
+
+			if (len > 0)
+				put(buf,static_cast<size_t>(len) < sizeof(buf) ? len : sizeof(buf)-1);
+		}
+
+	private:
+		FILE*              m_f;
+		bool               m_utf16;
+		unsigned long long m_written;
+
+		void write(const void* p, size_t len)
+		{
+			if (fwrite(p,1,len,m_f) != len)
+			{
+				fprintf(stderr,"Write failed\n");
+				exit(EXIT_FAILURE);
+			}
+			m_written += len;
+		}
+	};
+
+	// xorshift32, seeded per shape
+	class Random
+	{
+	public:
+		Random(unsigned int seed) : m_state(seed ? seed : 1)
+		{}
+
+		unsigned int next(unsigned int range)
+		{
+			m_state ^= m_state << 13;
+			m_state ^= m_state >> 17;
+			m_state ^= m_state << 5;
+			return m_state % range;
+		}
+
+		const char* word()
+		{
+			static const char* const words[] =
+			{
+				"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+				"india", "juliet", "kilo", "lima", "mike", "november", "oscar", "papa",
+				"quebec", "romeo", "sierra", "tango", "uniform", "victor", "whiskey", "xray",
+				"yankee", "zulu", "lorem", "ipsum", "dolor", "sit", "amet", "consectetur"
+			};
+			return words[next(sizeof(words)/sizeof(words[0]))];
+		}
+
+	private:
+		unsigned int m_state;
+	};
+
+	void sentence(Writer& w, Random& r, unsigned int words)
+	{
+		for (unsigned int i = 0;i < words;++i)
+		{
+			if (i)
+				w.put(" ");
+			w.put(r.word());
+		}
+		w.put(".");
+	}
+
+	void gen_attrs(Writer& w, Random& r, unsigned long long size)
+	{
+		w.put("<?xml version=\"1.0\"?>\n<doc>\n");
+		while (w.written() < size)
+		{
+			w.format("<item id=\"i%u\"",r.next(1000000));
+			for (unsigned int i = 0, n = 4 + r.next(12);i < n;++i)
+				w.format(" %s%u=\"%s %s\"",r.word(),i,r.word(),r.word());
+			w.put("/>\n");
+		}
+		w.put("</doc>\n");
+	}
+
+	void gen_text(Writer& w, Random& r, unsigned long long size)
+	{
+		w.put("<?xml version=\"1.0\"?>\n<doc>\n");
+		while (w.written() < size)
+		{
+			w.put("<p>");
+			for (unsigned int i = 0, n = 2 + r.next(8);i < n;++i)
+			{
+				if (i)
+					w.put("\n");
+				sentence(w,r,6 + r.next(20));
+			}
+			w.put("</p>\n");
+		}
+		w.put("</doc>\n");
+	}
+
+	void gen_nested(Writer& w, Random& r, unsigned long long size)
+	{
+		w.put("<?xml version=\"1.0\"?>\n<doc>\n");
+		while (w.written() < size)
+		{
+			unsigned int depth = 1 + r.next(64);
+			for (unsigned int i = 0;i < depth;++i)
+				w.format("<n%u>",i);
+
+			w.put(r.word());
+
+			for (unsigned int i = depth;i-- > 0;)
+				w.format("</n%u>",i);
+			w.put("\n");
+		}
+		w.put("</doc>\n");
+	}
+
+	void gen_entity(Writer& w, Random& r, unsigned long long size)
+	{
+		w.put("<?xml version=\"1.0\"?>\n"
+				"<!DOCTYPE doc [\n"
+				"<!ENTITY short \"s\">\n"
+				"<!ENTITY long \"a much longer replacement text with &amp; escapes &#x41;\">\n"
+				"<!ENTITY nested \"&short; and &long;\">\n"
+				"]>\n<doc>\n");
+
+		static const char* const refs[] =
+		{
+			"&amp;", "&lt;", "&gt;", "&quot;", "&apos;", "&#65;", "&#x263A;", "&#1234;", "&short;", "&long;", "&nested;"
+		};
+
+		while (w.written() < size)
+		{
+			w.format("<e a=\"%s%s\">",r.word(),refs[r.next(5)]);
+			for (unsigned int i = 0, n = 4 + r.next(16);i < n;++i)
+			{
+				w.put(r.word());
+				w.put(refs[r.next(sizeof(refs)/sizeof(refs[0]))]);
+			}
+			w.put("</e>\n");
+		}
+		w.put("</doc>\n");
+	}
+
+	void gen_cdata(Writer& w, Random& r, unsigned long long size)
+	{
+		w.put("<?xml version=\"1.0\"?>\n<doc>\n");
+		while (w.written() < size)
+		{
+			w.put("<c><![CDATA[");
+			for (unsigned int i = 0, n = 4 + r.next(32);i < n;++i)
+			{
+				w.put(r.word());
+				w.put(r.next(4) ? " " : " <&> ] ]> ");
+			}
+			w.put("]]></c>\n");
+		}
+		w.put("</doc>\n");
+	}
+
+	void gen_utf16(Writer& w, Random& r, unsigned long long size)
+	{
+		w.put("<?xml version=\"1.0\" encoding=\"UTF-16\"?>\n<doc>\n");
+		while (w.written() < size)
+		{
+			w.format("<item kind=\"%s\">",r.word());
+			sentence(w,r,4 + r.next(16));
+			w.put("</item>\n");
+		}
+		w.put("</doc>\n");
+	}
+
+	void gen_dtd(Writer& w, Random& r, unsigned long long size)
+	{
+		w.put("<?xml version=\"1.0\"?>\n"
+				"<!DOCTYPE doc [\n"
+				"<!ELEMENT doc (rec)*>\n"
+				"<!ELEMENT rec (name,value+,note?)>\n"
+				"<!ELEMENT name (#PCDATA)>\n"
+				"<!ELEMENT value (#PCDATA)>\n"
+				"<!ELEMENT note (#PCDATA|b|i)*>\n"
+				"<!ELEMENT b (#PCDATA)>\n"
+				"<!ELEMENT i (#PCDATA)>\n"
+				"<!ATTLIST rec id ID #REQUIRED\n"
+				"              ref IDREF #IMPLIED\n"
+				"              kind (x|y|z) \"x\"\n"
+				"              tags NMTOKENS #IMPLIED\n"
+				"              version CDATA #FIXED \"1\">\n"
+				"<!ENTITY copy \"(c) nobody\">\n"
+				"]>\n<doc>\n");
+
+		unsigned int id = 0;
+		while (w.written() < size)
+		{
+			w.format("<rec id=\"r%u\"",id);
+			if (id && r.next(2))
+				w.format(" ref=\"r%u\"",r.next(id));
+			if (r.next(2))
+				w.format(" tags=\"  %s   %s \"",r.word(),r.word());
+			w.format("><name>%s</name>",r.word());
+			for (unsigned int i = 0, n = 1 + r.next(4);i < n;++i)
+				w.format("<value>%u</value>",r.next(100000));
+			if (r.next(3) == 0)
+				w.format("<note>%s <b>%s</b> &copy;</note>",r.word(),r.word());
+			w.put("</rec>\n");
+			++id;
+		}
+		w.put("</doc>\n");
+	}
+
+	bool parse_size(const char* sz, unsigned long long& size)
+	{
+		char* end = NULL;
+		size = strtoull(sz,&end,10);
+		if (end == sz)
+			return false;
+
+		switch (*end)
+		{
+		case 'G':
+		case 'g':
+			size *= 1024;
+			// Fall through
+		case 'M':
+		case 'm':
+			size *= 1024;
+			// Fall through
+		case 'K':
+		case 'k':
+			size *= 1024;
+			++end;
+			break;
+
+		default:
+			break;
+		}
+
+		return (*end == '\0' && size > 0);
+	}
+
+	struct Shape
+	{
+		const char*  m_name;
+		unsigned int m_seed;
+		void (*m_fn)(Writer&,Random&,unsigned long long);
+	};
+
+	const Shape shapes[] =
+	{
+		{ "attrs", 0x1234567, &gen_attrs },
+		{ "text", 0x2345678, &gen_text },
+		{ "nested", 0x3456789, &gen_nested },
+		{ "entity", 0x456789A, &gen_entity },
+		{ "cdata", 0x56789AB, &gen_cdata },
+		{ "utf16", 0x6789ABC, &gen_utf16 },
+		{ "dtd", 0x789ABCD, &gen_dtd },
+		{ NULL, 0, NULL }
+	};
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned long long size = 0;
+	if (argc != 4 || !parse_size(argv[2],size))
+	{
+		fprintf(stderr,"Usage: %s <shape> <size>[K|M|G] <output file>\nShapes:",argv[0]);
+		for (const Shape* s = shapes;s->m_name;++s)
+			fprintf(stderr," %s",s->m_name);
+		fprintf(stderr,"\n");
+		return EXIT_FAILURE;
+	}
+
+	const Shape* shape = shapes;
+	while (shape->m_name && strcmp(shape->m_name,argv[1]) != 0)
+		++shape;
+
+	if (!shape->m_name)
+	{
+		fprintf(stderr,"Unknown shape: %s\n",argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	FILE* f = fopen(argv[3],"wb");
+	if (!f)
+	{
+		fprintf(stderr,"Failed to open %s\n",argv[3]);
+		return EXIT_FAILURE;
+	}
+
+	Writer w(f,strcmp(shape->m_name,"utf16") == 0);
+	Random r(shape->m_seed);
+	(*shape->m_fn)(w,r,size);
+
+	fclose(f);
+	return EXIT_SUCCESS;
+}
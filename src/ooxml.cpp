@@ -19,192 +19,218 @@
 //
 ///////////////////////////////////////////////////////////////////////////////////
 
+#include "BatchParser.h"
 #include "Tokenizer.h"
+#include "Clock.h"
 
 #include <OOBase/Vector.h>
 #include <OOBase/ArenaAllocator.h>
 #include <OOBase/Set.h>
+#include <OOBase/Mutex.h>
+#include <OOBase/Thread.h>
 
-static size_t passed = 0;
-static size_t failed = 0;
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static const int verbose = 0;
+static const size_t no_profile = size_t(-1);
 
-static bool do_wf_test(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& strURI, bool fail_expected)
+// The test suite is read first, into a list of entries in document order,
+// then the tests are run on a pool of threads, then the results are printed in order.
+struct Entry
+{
+	enum Kind
+	{
+		Suite,
+		Profile,
+		Test,
+		Skip
+	};
+
+	Entry(OOBase::AllocatorInstance& allocator, Kind kind, size_t profile) :
+			m_kind(kind),
+			m_profile(profile),
+			m_strName(allocator),
+			m_strType(allocator),
+			m_strURI(allocator),
+			m_strText(allocator),
+			m_wf(false),
+			m_valid(false),
+			m_ns(0)
+	{
+		m_szValidity[0] = '\0';
+		m_szSyntax[0] = '\0';
+	}
+
+	Kind                m_kind;
+	size_t              m_profile;
+	OOBase::LocalString m_strName;
+	OOBase::LocalString m_strType;
+	OOBase::LocalString m_strURI;
+	OOBase::LocalString m_strText;
+
+	// Results, written by exactly one worker
+	bool               m_wf;
+	bool               m_valid;
+	char               m_szValidity[256];
+	char               m_szSyntax[256];
+	unsigned long long m_ns;
+};
+
+typedef OOBase::Vector<Entry,OOBase::AllocatorInstance> EntryList;
+
+// Classifies a document as well-formed and/or valid in a single parse
+static void classify(OOBase::AllocatorInstance& allocator, Tokenizer& tok, Entry& e)
 {
 	OOBase::Vector<OOBase::LocalString,OOBase::AllocatorInstance> elements(allocator);
 	OOBase::Set<OOBase::LocalString,OOBase::AllocatorInstance> attributes(allocator);
+	OOBase::LocalString strURI(allocator);
+	OOBase::LocalString strToken(allocator);
+	bool wf = true;
 
-	Tokenizer tok(allocator);
-
-	tok.load(strURI);
+	if (strURI.assign(e.m_strURI.c_str(),e.m_strURI.length()) != 0)
+		throw "Out of memory";
 
-	Tokenizer::TokenType tok_type;
-	do
+	Tokenizer::TokenType tok_type = Tokenizer::Error;
+	try
 	{
-		OOBase::LocalString strToken(allocator);
-		tok_type = tok.next_token(strToken,verbose);
+		tok.load(strURI);
 
-		if (tok_type == Tokenizer::ElementStart)
-		{
-			elements.push_back(strToken);
-			attributes.clear();
-		}
-		else if (tok_type == Tokenizer::AttributeName)
+		do
 		{
-			if (attributes.exists(strToken))
-				return false;
+			tok_type = tok.next_token(strToken,verbose);
 
-			attributes.insert(strToken);
-		}
-		else if (tok_type == Tokenizer::ElementEnd)
-		{
-			OOBase::LocalString strE(allocator);
-			elements.pop_back(&strE);
+			if (tok_type == Tokenizer::ElementStart)
+			{
+				elements.push_back(strToken);
+				attributes.clear();
+			}
+			else if (tok_type == Tokenizer::AttributeName)
+			{
+				if (attributes.exists(strToken))
+				{
+					wf = false;
+					break;
+				}
 
-			if (!strToken.empty() && strE != strToken)
-				return false;
+				attributes.insert(strToken);
+			}
+			else if (tok_type == Tokenizer::ElementEnd)
+			{
+				OOBase::LocalString strE(allocator);
+				elements.pop_back(&strE);
+
+				if (!strToken.empty() && strE != strToken)
+				{
+					wf = false;
+					break;
+				}
+			}
 		}
-	}
-	while (tok_type != Tokenizer::End && tok_type != Tokenizer::Error);
+		while (tok_type != Tokenizer::End && tok_type != Tokenizer::Error);
 
-	if (tok_type == Tokenizer::Error && !fail_expected)
-		printf("\nSyntax error at %s, line %lu, col %lu\n",tok.get_location().c_str(),tok.get_line(),tok.get_column());
+		if (tok_type == Tokenizer::Error)
+			snprintf(e.m_szSyntax,sizeof(e.m_szSyntax),"Syntax error at %s, line %lu, col %lu",tok.get_location().c_str(),(unsigned long)tok.get_line(),(unsigned long)tok.get_column());
+	}
+	catch (const char* err)
+	{
+		// load() throws if the test file cannot be opened
+		tok_type = Tokenizer::Error;
+		snprintf(e.m_szSyntax,sizeof(e.m_szSyntax),"%s opening %s",err,e.m_strURI.c_str());
+	}
 
-	return (tok_type == Tokenizer::End);
+	e.m_wf = (wf && tok_type == Tokenizer::End);
+	e.m_valid = (e.m_wf && tok.is_valid());
+	if (e.m_wf && !e.m_valid)
+		snprintf(e.m_szValidity,sizeof(e.m_szValidity),"%s",tok.get_validity_error().c_str());
 }
 
-static bool do_valid_test(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& strURI, bool fail_expected)
+struct Runner
 {
-	OOBase::Vector<OOBase::LocalString,OOBase::AllocatorInstance> elements(allocator);
-	OOBase::Set<OOBase::LocalString,OOBase::AllocatorInstance> attributes(allocator);
-	OOBase::LocalString strDocType(allocator);
-	bool root = true;
+	Runner(EntryList& entries) : m_entries(entries), m_next(0)
+	{}
 
-	Tokenizer tok(allocator);
+	EntryList&       m_entries;
+	OOBase::SpinLock m_lock;
+	size_t           m_next;
+};
 
-	tok.load(strURI);
+static int run_tests(void* param)
+{
+	Runner* runner = static_cast<Runner*>(param);
 
-	Tokenizer::TokenType tok_type;
-	do
-	{
-		OOBase::LocalString strToken(allocator);
-		tok_type = tok.next_token(strToken,verbose);
+	// Each worker has its own allocator and Tokenizer, so shares nothing while parsing
+	OOBase::ArenaAllocator allocator;
+	Tokenizer tok(allocator);
 
-		if (tok_type == Tokenizer::DocTypeStart)
+	for (;;)
+	{
+		size_t i = 0;
 		{
-			strDocType = strToken;
+			OOBase::Guard<OOBase::SpinLock> guard(runner->m_lock);
+			i = runner->m_next++;
 		}
-		else if (tok_type == Tokenizer::ElementStart)
-		{
-			if (root)
-			{
-				if (strDocType.empty())
-				{
-					if (!fail_expected)
-						printf("No DOCTYPE\n");
-					return false;
-				}
 
-				if (strToken != strDocType)
-				{
-					if (!fail_expected)
-						printf("Mismatched root element\n");
-					return false;
-				}
-
-				root = false;
-			}
+		if (i >= runner->m_entries.size())
+			break;
 
-			elements.push_back(strToken);
-			attributes.clear();
-		}
-		else if (tok_type == Tokenizer::AttributeName)
+		Entry& e = runner->m_entries[i];
+		if (e.m_kind == Entry::Test)
 		{
-			if (attributes.exists(strToken))
-				return false;
-
-			attributes.insert(strToken);
-		}
-		else if (tok_type == Tokenizer::ElementEnd)
-		{
-			OOBase::LocalString strE(allocator);
-			elements.pop_back(&strE);
-
-			if (!strToken.empty() && strE != strToken)
-				return false;
+			unsigned long long start = clock_ns();
+			classify(allocator,tok,e);
+			e.m_ns = clock_ns() - start;
 		}
 	}
-	while (tok_type != Tokenizer::End && tok_type != Tokenizer::Error);
 
-	return (tok_type == Tokenizer::End);
+	return 0;
 }
 
-static bool pass()
+static void run_parallel(OOBase::AllocatorInstance& allocator, EntryList& entries, size_t threads)
 {
-	printf("[OK]\n");
-	++passed;
-	return true;
-}
+	Runner runner(entries);
 
-static bool fail()
-{
-	printf("[Fail] ");
-	++failed;
-	return false;
-}
+	// The calling thread is a worker too
+	OOBase::Thread* pool = NULL;
+	if (threads > 1)
+	{
+		pool = static_cast<OOBase::Thread*>(allocator.allocate(sizeof(OOBase::Thread) * (threads - 1),OOBase::alignment_of<OOBase::Thread>::value));
+		if (!pool)
+			threads = 1;
+	}
 
-static bool do_valid_test(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& strURI)
-{
-	if (do_valid_test(allocator,strURI,false))
-		return pass();
-	else if (do_wf_test(allocator,strURI,false))
+	for (size_t i = 0;i < threads - 1;++i)
 	{
-		printf("[Well-formed] ");
-		++passed;
-		return false;
+		::new (&pool[i]) OOBase::Thread(false);
+		pool[i].run(&run_tests,&runner);
 	}
-	else
-		return fail();
-}
 
-static bool do_invalid_test(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& strURI)
-{
-	if (!do_wf_test(allocator,strURI,false))
-		return fail();
-	else if (!do_valid_test(allocator,strURI,true))
-		return pass();
-	else
+	run_tests(&runner);
+
+	for (size_t i = 0;i < threads - 1;++i)
 	{
-		printf("[Well-formed] ");
-		++passed;
-		return false;
+		pool[i].join();
+		pool[i].~Thread();
 	}
-}
 
-static bool do_not_wf_test(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& strURI)
-{
-	if (do_wf_test(allocator,strURI,true))
-		return fail();
-	else
-		return pass();
+	allocator.free(pool);
 }
 
-static bool do_error_test(OOBase::AllocatorInstance& allocator, const OOBase::LocalString& strURI)
+static void push_entry(EntryList& entries, const Entry& e)
 {
-	if (!do_wf_test(allocator,strURI,true))
-		return pass();
-
-	printf("[No error]\n");
-	return true;
+	if (entries.push_back(e) != 0)
+		throw "Out of memory";
 }
 
-static void do_test(OOBase::AllocatorInstance& allocator, Tokenizer& tok, const OOBase::LocalString& strBase)
+static void do_test(OOBase::AllocatorInstance& allocator, Tokenizer& tok, const OOBase::LocalString& strBase, size_t profile, EntryList& entries)
 {
-	OOBase::LocalString strType(allocator),strText(allocator);
-	OOBase::LocalString strURI = strBase;
+	Entry e(allocator,Entry::Test,profile);
 	OOBase::LocalString strEdition(allocator);
 	OOBase::LocalString strNamespace(allocator);
+
+	e.m_strURI = strBase;
+
 	Tokenizer::TokenType tok_type;
 	do
 	{
@@ -216,17 +242,17 @@ static void do_test(OOBase::AllocatorInstance& allocator, Tokenizer& tok, const
 			if (strToken == "ID")
 			{
 				if (tok.next_token(strToken,verbose) == Tokenizer::AttributeValue)
-					printf("Test: %s...",strToken.c_str());
+					e.m_strName = strToken;
 			}
 			else if (strToken == "TYPE")
 			{
 				if (tok.next_token(strToken,verbose) == Tokenizer::AttributeValue)
-					strType = strToken;
+					e.m_strType = strToken;
 			}
 			else if (strToken == "URI")
 			{
 				if (tok.next_token(strToken,verbose) == Tokenizer::AttributeValue)
-					strURI.append(strToken.c_str());
+					e.m_strURI.append(strToken.c_str());
 			}
 			else if (strToken == "EDITION")
 			{
@@ -241,39 +267,32 @@ static void do_test(OOBase::AllocatorInstance& allocator, Tokenizer& tok, const
 		}
 		else if (tok_type == Tokenizer::Text)
 		{
-			strText.append(strToken.c_str());
+			e.m_strText.append(strToken.c_str());
 		}
 		else if (tok_type == Tokenizer::ElementEnd && strToken == "TEST")
 		{
 			if (strNamespace == "no")
-				printf("Skipping, test only applies to non-namespace parsers\n");
+			{
+				e.m_kind = Entry::Skip;
+				e.m_strText.assign("Skipping, test only applies to non-namespace parsers");
+			}
 			else if (!strEdition.empty() && strEdition.find('5') == OOBase::LocalString::npos)
-				printf("Skipping, test only applies to editions %s\n",strEdition.c_str());
-			else
 			{
-				bool ret = false;
-				if (strType == "valid")
-					ret = do_valid_test(tok.get_allocator(),strURI);
-				else if (strType == "invalid")
-					ret = do_invalid_test(tok.get_allocator(),strURI);
-				else if (strType == "not-wf")
-					ret = do_not_wf_test(tok.get_allocator(),strURI);
-				else if (strType == "error")
-					ret = do_error_test(tok.get_allocator(),strURI);
-				else
-					return;
-
-				if (!ret && !strText.empty())
-					printf("%s\n\n",strText.c_str());
+				e.m_kind = Entry::Skip;
+				e.m_strText.assign("Skipping, test only applies to editions ");
+				e.m_strText.append(strEdition.c_str());
 			}
+			else if (e.m_strType != "valid" && e.m_strType != "invalid" && e.m_strType != "not-wf" && e.m_strType != "error")
+				return;
 
+			push_entry(entries,e);
 			return;
 		}
 	}
 	while (tok_type != Tokenizer::End && tok_type != Tokenizer::Error);
 }
 
-static void do_test_cases(OOBase::AllocatorInstance& allocator, Tokenizer& tok, const OOBase::LocalString& strParent)
+static void do_test_cases(OOBase::AllocatorInstance& allocator, Tokenizer& tok, const OOBase::LocalString& strParent, size_t profile, EntryList& entries)
 {
 	OOBase::LocalString strBase = strParent;
 	Tokenizer::TokenType tok_type;
@@ -292,15 +311,20 @@ static void do_test_cases(OOBase::AllocatorInstance& allocator, Tokenizer& tok,
 			else if (strToken == "PROFILE")
 			{
 				if (tok.next_token(strToken,verbose) == Tokenizer::AttributeValue)
-					printf("\nRunning test cases: %s\n",strToken.c_str());
+				{
+					Entry e(allocator,Entry::Profile,entries.size());
+					e.m_strName = strToken;
+					profile = e.m_profile;
+					push_entry(entries,e);
+				}
 			}
 		}
 		else if (tok_type == Tokenizer::ElementStart)
 		{
 			if (strToken == "TESTCASES")
-				do_test_cases(allocator,tok,strBase);
+				do_test_cases(allocator,tok,strBase,profile,entries);
 			else if (strToken == "TEST")
-				do_test(allocator,tok,strBase);
+				do_test(allocator,tok,strBase,profile,entries);
 		}
 		else if (tok_type == Tokenizer::ElementEnd && strToken == "TESTCASES")
 			return;
@@ -308,8 +332,9 @@ static void do_test_cases(OOBase::AllocatorInstance& allocator, Tokenizer& tok,
 	while (tok_type != Tokenizer::End && tok_type != Tokenizer::Error);
 }
 
-static void do_test_suite(OOBase::AllocatorInstance& allocator, Tokenizer& tok, const OOBase::LocalString& strParent)
+static void do_test_suite(OOBase::AllocatorInstance& allocator, Tokenizer& tok, const OOBase::LocalString& strParent, EntryList& entries)
 {
+	size_t profile = no_profile;
 	Tokenizer::TokenType tok_type;
 	do
 	{
@@ -319,16 +344,147 @@ static void do_test_suite(OOBase::AllocatorInstance& allocator, Tokenizer& tok,
 		if (tok_type == Tokenizer::AttributeName && strToken == "PROFILE")
 		{
 			if (tok.next_token(strToken,verbose) == Tokenizer::AttributeValue)
-				printf("\nRunning suite: %s\n",strToken.c_str());
+			{
+				Entry e(allocator,Entry::Suite,entries.size());
+				e.m_strName = strToken;
+				profile = e.m_profile;
+				push_entry(entries,e);
+			}
 		}
 		else if (tok_type == Tokenizer::ElementStart && strToken == "TESTCASES")
-			do_test_cases(allocator,tok,strParent);
+			do_test_cases(allocator,tok,strParent,profile,entries);
 		else if (tok_type == Tokenizer::ElementEnd && strToken == "TESTSUITE")
 			return;
 	}
 	while (tok_type != Tokenizer::End && tok_type != Tokenizer::Error);
 }
 
+static bool report(const Entry& e, size_t& passed, size_t& failed)
+{
+	printf("Test: %s (%.3f ms)...",e.m_strName.c_str(),e.m_ns / 1e6);
+
+	if (e.m_strType == "valid")
+	{
+		if (e.m_valid)
+		{
+			printf("[OK]\n");
+			++passed;
+			return true;
+		}
+
+		if (e.m_szValidity[0])
+			printf("%s\n",e.m_szValidity);
+
+		if (e.m_wf)
+		{
+			printf("[Well-formed] ");
+			++passed;
+			return false;
+		}
+
+		if (e.m_szSyntax[0])
+			printf("\n%s\n",e.m_szSyntax);
+	}
+	else if (e.m_strType == "invalid")
+	{
+		if (e.m_wf)
+		{
+			if (!e.m_valid)
+			{
+				printf("[OK]\n");
+				++passed;
+				return true;
+			}
+
+			printf("[Well-formed] ");
+			++passed;
+			return false;
+		}
+
+		if (e.m_szSyntax[0])
+			printf("\n%s\n",e.m_szSyntax);
+	}
+	else if (e.m_strType == "not-wf")
+	{
+		if (!e.m_wf)
+		{
+			printf("[OK]\n");
+			++passed;
+			return true;
+		}
+	}
+	else if (e.m_strType == "error")
+	{
+		if (!e.m_wf)
+		{
+			printf("[OK]\n");
+			++passed;
+			return true;
+		}
+
+		printf("[No error]\n");
+		return true;
+	}
+
+	printf("[Fail] ");
+	++failed;
+	return false;
+}
+
+static void report_all(const EntryList& entries)
+{
+	size_t passed = 0;
+	size_t failed = 0;
+
+	for (size_t i = 0;i < entries.size();++i)
+	{
+		const Entry& e = entries[i];
+		switch (e.m_kind)
+		{
+		case Entry::Suite:
+			printf("\nRunning suite: %s\n",e.m_strName.c_str());
+			break;
+
+		case Entry::Profile:
+			printf("\nRunning test cases: %s\n",e.m_strName.c_str());
+			break;
+
+		case Entry::Skip:
+			printf("Test: %s...%s\n",e.m_strName.c_str(),e.m_strText.c_str());
+			break;
+
+		case Entry::Test:
+			if (!report(e,passed,failed) && !e.m_strText.empty())
+				printf("%s\n\n",e.m_strText.c_str());
+			break;
+		}
+	}
+
+	// Parse time summed per profile, the wall time is shorter when run in parallel
+	printf("\n%-60s %6s %12s\n","Profile","Tests","Parse ms");
+	for (size_t i = 0;i < entries.size();++i)
+	{
+		if (entries[i].m_kind != Entry::Suite && entries[i].m_kind != Entry::Profile)
+			continue;
+
+		size_t tests = 0;
+		unsigned long long ns = 0;
+		for (size_t j = i + 1;j < entries.size();++j)
+		{
+			if (entries[j].m_kind == Entry::Test && entries[j].m_profile == i)
+			{
+				++tests;
+				ns += entries[j].m_ns;
+			}
+		}
+
+		if (tests)
+			printf("%-60s %6lu %12.3f\n",entries[i].m_strName.c_str(),(unsigned long)tests,ns / 1e6);
+	}
+
+	printf("\n%lu passed, %lu failed\n",(unsigned long)passed,(unsigned long)failed);
+}
+
 static void split_dir_and_fname(const char* path, OOBase::LocalString& dir, OOBase::LocalString& file)
 {
 	const char* s = strrchr(path,'/');
@@ -347,6 +503,16 @@ static void split_dir_and_fname(const char* path, OOBase::LocalString& dir, OOBa
 
 int main( int argc, char* argv[] )
 {
+	if (argc < 2)
+	{
+		fprintf(stderr,"Usage: %s <xmlconf.xml> [threads]\n",argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	size_t threads = BatchParser::cpu_count();
+	if (argc > 2 && atoi(argv[2]) > 0)
+		threads = static_cast<size_t>(atoi(argv[2]));
+
 	//OOBase::StackAllocator<4096> allocator;
 	OOBase::ArenaAllocator allocator;
 	Tokenizer tok(allocator);
@@ -357,8 +523,12 @@ int main( int argc, char* argv[] )
 	OOBase::LocalString strLoad(allocator);
 	strLoad.assign(argv[1]);
 
+	unsigned long long start = clock_ns();
+
 	tok.load(strLoad);
 
+	EntryList entries(allocator);
+
 	Tokenizer::TokenType tok_type;
 	do
 	{
@@ -366,23 +536,18 @@ int main( int argc, char* argv[] )
 		tok_type = tok.next_token(strToken,verbose);
 
 		if (tok_type == Tokenizer::ElementStart && strToken == "TESTSUITE")
-			do_test_suite(allocator,tok,path);
+			do_test_suite(allocator,tok,path,entries);
 	}
 	while (tok_type != Tokenizer::End && tok_type != Tokenizer::Error);
 
 	if (tok_type == Tokenizer::Error)
 		printf("\nSyntax error at %s, line %lu, col %lu\n",tok.get_location().c_str(),tok.get_line(),tok.get_column());
 
-	printf("\n%lu passed, %lu failed\n",passed,failed);
-		
-	return 0;
-}
+	run_parallel(allocator,entries,threads);
 
-OOBase::LocalString resolve_url(const OOBase::LocalString& strBase, const OOBase::LocalString& strPublicId, const OOBase::LocalString& strSystemId)
-{
-	OOBase::LocalString path(strBase.get_allocator()),file(strBase.get_allocator());
-	split_dir_and_fname(strBase.c_str(),path,file);
+	report_all(entries);
 
-	path.append(strSystemId.c_str());
-	return path;
+	printf("Wall time %.3f ms on %lu threads\n",(clock_ns() - start) / 1e6,(unsigned long)threads);
+
+	return 0;
 }
@@ -0,0 +1,999 @@
+///////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2012 Rick Taylor
+//
+// This file is part of OOXML, the Omega Online XML library.
+//
+// OOXML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OOXML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with OOXML.  If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////
+
+// Unit tests for behaviour the conformance suite does not reach, run by 'make check'
+
+#include "BatchParser.h"
+#include "Decompressor.h"
+#include "PathFilter.h"
+#include "Pipeline.h"
+#include "ReadAhead.h"
+#include "Resolver.h"
+#include "Tokenizer.h"
+#include "TokenizerPool.h"
+
+#include <OOBase/ArenaAllocator.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { fprintf(stderr,"%s:%d: CHECK(%s) failed\n",__FILE__,__LINE__,#expr); ++failures; } } while (false)
+
+namespace
+{
+	void add_doc(CatalogResolver& resolver, const char* szSystemId, const char* text)
+	{
+		if (resolver.add(NULL,szSystemId,text,strlen(text)) != 0)
+			throw "Out of memory";
+	}
+
+	void append(OOBase::LocalString& str, const char* sz, size_t len)
+	{
+		if (str.append(sz,len) != 0)
+			throw "Out of memory";
+	}
+
+	// Each token as a prefix and its text, separated by spaces: <!b !> <b @a ="v" "text" /b $
+	void append_token(OOBase::LocalString& str, Tokenizer::TokenType type, const OOBase::LocalString& strToken)
+	{
+		static const char* const prefixes[] = { "!!", "$", "<!", "!>", "<", "/", "@", "=", "\"", "<?", "?", "#", "[" };
+
+		if (!str.empty())
+			append(str," ",1);
+		append(str,prefixes[type],strlen(prefixes[type]));
+		if (type > Tokenizer::End)
+			append(str,strToken.c_str(),strToken.length());
+	}
+
+	void load(Tokenizer& tok, const char* szSystemId)
+	{
+		OOBase::LocalString strName(tok.get_allocator());
+		if (strName.assign(szSystemId) != 0)
+			throw "Out of memory";
+
+		tok.load(strName);
+	}
+
+	// Parses the whole document, returning End or Error
+	Tokenizer::TokenType parse(Tokenizer& tok, const char* szSystemId, OOBase::LocalString& str)
+	{
+		str.clear();
+		load(tok,szSystemId);
+
+		OOBase::LocalString strToken(tok.get_allocator());
+		for (;;)
+		{
+			Tokenizer::TokenType type = tok.next_token(strToken,0);
+			append_token(str,type,strToken);
+			if (type == Tokenizer::End || type == Tokenizer::Error)
+				return type;
+		}
+	}
+
+	// Runs the filter over the whole document, returning End or Error
+	Tokenizer::TokenType filter(PathFilter& pf, Tokenizer& tok, const char* szSystemId, OOBase::LocalString& str)
+	{
+		str.clear();
+		load(tok,szSystemId);
+		pf.reset();
+
+		OOBase::LocalString strToken(tok.get_allocator());
+		for (;;)
+		{
+			size_t id = PathFilter::npos;
+			Tokenizer::TokenType type = pf.next_token(tok,strToken,id);
+			append_token(str,type,strToken);
+			if (type == Tokenizer::End || type == Tokenizer::Error)
+				return type;
+		}
+	}
+
+	bool contains(const OOBase::LocalString& str, const char* sz)
+	{
+		return strstr(str.c_str(),sz) != NULL;
+	}
+}
+
+static void test_shared_entities()
+{
+	OOBase::ArenaAllocator allocator;
+	CatalogResolver resolver(allocator);
+
+	add_doc(resolver,"shared.xml","<!DOCTYPE s [<!ENTITY foo 'bar'><!ENTITY ext SYSTEM 'ext.ent'>]><s/>");
+	add_doc(resolver,"ext.ent","shared");
+	add_doc(resolver,"local.ent","local");
+	add_doc(resolver,"doctype.xml","<!DOCTYPE b><b>&foo;</b>");
+	add_doc(resolver,"lean.xml","<b>&foo;</b>");
+	add_doc(resolver,"redeclared.xml","<!DOCTYPE b [<!ENTITY foo SYSTEM 'local.ent'><!ENTITY ext 'internal'>]><b>&foo;&ext;</b>");
+
+	Tokenizer tok(allocator);
+	tok.set_resolver(resolver);
+
+	OOBase::LocalString str(allocator);
+	CHECK(parse(tok,"shared.xml",str) == Tokenizer::End);
+
+	EntityTable* shared = tok.share_entities(allocator);
+	tok.set_entities(shared);
+	shared->release();
+
+	// Shared entities are visible once there is a DOCTYPE
+	CHECK(parse(tok,"doctype.xml",str) == Tokenizer::End);
+	CHECK(contains(str,"\"bar"));
+
+	// But a document without one could never have declared them
+	CHECK(parse(tok,"lean.xml",str) == Tokenizer::Error);
+	CHECK(!contains(str,"\"bar"));
+
+	// A local declaration of either kind hides the shared one
+	CHECK(parse(tok,"redeclared.xml",str) == Tokenizer::End);
+	CHECK(contains(str,"\"local"));
+	CHECK(contains(str,"\"internal"));
+	CHECK(!contains(str,"bar"));
+	CHECK(!contains(str,"shared"));
+}
+
+static void test_path_filter_defaults()
+{
+	OOBase::ArenaAllocator allocator;
+	CatalogResolver resolver(allocator);
+
+	add_doc(resolver,"defaults.xml",
+			"<!DOCTYPE r [<!ATTLIST a y CDATA 'def'><!ATTLIST c d CDATA 'leak'>]>"
+			"<r><a x='1'><c/><c d='given'/></a></r>");
+
+	Tokenizer tok(allocator);
+	tok.set_resolver(resolver);
+
+	PathFilter pf(allocator);
+	size_t id = 0;
+	CHECK(pf.add("/r/a/@*",id) == 0);
+
+	// The element's own defaults are selected, but not those of the elements within it
+	OOBase::LocalString str(allocator);
+	CHECK(filter(pf,tok,"defaults.xml",str) == Tokenizer::End);
+	CHECK(!strcmp(str.c_str(),"@x =1 @y =def $"));
+	CHECK(!contains(str,"leak"));
+	CHECK(!contains(str,"given"));
+}
+
+namespace
+{
+	// The offset of <a id='x'/> found through the ID index
+	unsigned long long id_offset(Tokenizer& tok, const char* szSystemId)
+	{
+		OOBase::LocalString str(tok.get_allocator());
+		CHECK(parse(tok,szSystemId,str) == Tokenizer::End);
+
+		OOBase::LocalString strId(tok.get_allocator());
+		if (strId.assign("x") != 0)
+			throw "Out of memory";
+
+		size_t element = 0;
+		unsigned long long offset = 0;
+		CHECK(tok.find_id(strId,element,offset));
+		return offset;
+	}
+
+	unsigned long long expected_offset(const char* doc)
+	{
+		return strstr(doc,"<a ") - doc;
+	}
+}
+
+static void test_offsets()
+{
+	OOBase::ArenaAllocator allocator;
+	CatalogResolver resolver(allocator);
+
+	static const char no_decl[] = "<!DOCTYPE r [<!ATTLIST a id ID #IMPLIED>]><r>\n<a id='x'/></r>";
+	static const char decl[] = "<?xml version='1.0'?><!DOCTYPE r [<!ATTLIST a id ID #IMPLIED>]><r>\n<a id='x'/></r>";
+	static const char crlf[] = "<?xml version='1.0'?>\r\n<!DOCTYPE r [<!ATTLIST a id ID #IMPLIED>]>\r\n<r>\r\n<a id='x'/>\r\n</r>";
+	static const char pe[] = "<!DOCTYPE r [<!ENTITY % d '<!ATTLIST a id ID #IMPLIED>'>%d; %d;]><r>\n<a id='x'/></r>";
+
+	add_doc(resolver,"no_decl.xml",no_decl);
+	add_doc(resolver,"decl.xml",decl);
+	add_doc(resolver,"crlf.xml",crlf);
+	add_doc(resolver,"pe.xml",pe);
+
+	// The CRLF document as UTF-16LE, after a BOM
+	unsigned char utf16[2 + 2 * sizeof(crlf)] = { 0xFF, 0xFE };
+	for (size_t i = 0;i < sizeof(crlf) - 1;++i)
+		utf16[2 + 2 * i] = crlf[i];
+
+	if (resolver.add(NULL,"utf16.xml",utf16,2 + 2 * (sizeof(crlf) - 1)) != 0)
+		throw "Out of memory";
+
+	// Offsets are bytes of the file, counting neither read-ahead nor injected spaces twice
+	Tokenizer tok(allocator);
+	tok.set_resolver(resolver);
+
+	CHECK(id_offset(tok,"no_decl.xml") == expected_offset(no_decl));
+	CHECK(id_offset(tok,"decl.xml") == expected_offset(decl));
+	CHECK(id_offset(tok,"crlf.xml") == expected_offset(crlf));
+	CHECK(id_offset(tok,"pe.xml") == expected_offset(pe));
+	CHECK(id_offset(tok,"utf16.xml") == 2 + 2 * expected_offset(crlf));
+}
+
+namespace
+{
+	// Writes <r> with count <a>text</a> children, returning false if the file cannot be written
+	bool write_file(const char* fname, size_t count)
+	{
+		FILE* f = fopen(fname,"wb");
+		if (!f)
+			return false;
+
+		fputs("<r>",f);
+		for (size_t i = 0;i < count;++i)
+			fputs("<a>text</a>\n",f);
+		fputs("</r>",f);
+
+		return (fclose(f) == 0);
+	}
+
+	size_t count_elements(Tokenizer& tok, const char* fname)
+	{
+		load(tok,fname);
+
+		size_t count = 0;
+		OOBase::LocalString strToken(tok.get_allocator());
+		for (;;)
+		{
+			Tokenizer::TokenType type = tok.next_token(strToken,0);
+			if (type == Tokenizer::ElementStart)
+				++count;
+			else if (type == Tokenizer::End)
+				return count;
+			else if (type == Tokenizer::Error)
+				return 0;
+		}
+	}
+}
+
+static void test_file_sizes()
+{
+	OOBase::ArenaAllocator allocator;
+	Tokenizer tok(allocator);
+
+	// Small files are read whole, larger ones a block at a time in the background,
+	// or on this thread without read-ahead
+	static const size_t counts[] = { 0, 10, ReadAhead::block_size / 12 - 1, ReadAhead::block_size / 12 + 1, ReadAhead::block_size };
+	for (size_t i = 0;i < sizeof(counts) / sizeof(counts[0]);++i)
+	{
+		CHECK(write_file("ooxml-test.xml",counts[i]));
+
+		tok.set_read_ahead(true);
+		CHECK(count_elements(tok,"ooxml-test.xml") == counts[i] + 1);
+
+		tok.set_read_ahead(false);
+		CHECK(count_elements(tok,"ooxml-test.xml") == counts[i] + 1);
+	}
+
+	remove("ooxml-test.xml");
+}
+
+namespace
+{
+	bool ends_with(const OOBase::LocalString& str, const char* sz)
+	{
+		size_t len = strlen(sz);
+		return (str.length() >= len && !strcmp(str.c_str() + str.length() - len,sz));
+	}
+
+	// Skips the element <s>, returning the line it ended on, its attributes
+	// if skip_content() is used, and the tokens after it
+	size_t skip_s(Tokenizer& tok, const char* szSystemId, bool content, OOBase::LocalString& attrs, OOBase::LocalString& str)
+	{
+		attrs.clear();
+		str.clear();
+		load(tok,szSystemId);
+
+		OOBase::LocalString strToken(tok.get_allocator());
+		Tokenizer::TokenType type;
+		while ((type = tok.next_token(strToken,0)) != Tokenizer::ElementStart || strToken != "s")
+		{
+			if (type == Tokenizer::End || type == Tokenizer::Error)
+				return 0;
+		}
+
+		if (!content)
+			type = tok.skip_element();
+		else
+		{
+			while ((type = tok.skip_content(strToken)) == Tokenizer::AttributeName || type == Tokenizer::AttributeValue)
+				append_token(attrs,type,strToken);
+		}
+
+		CHECK(type == Tokenizer::ElementEnd);
+		size_t line = tok.get_line();
+
+		for (;;)
+		{
+			type = tok.next_token(strToken,0);
+			append_token(str,type,strToken);
+			if (type == Tokenizer::End || type == Tokenizer::Error)
+				return line;
+		}
+	}
+}
+
+static void test_skip()
+{
+	OOBase::ArenaAllocator allocator;
+	CatalogResolver resolver(allocator);
+
+	// Everything that could look like the end of <s> is within markup it must pass over
+	static const char* const docs[] =
+	{
+		"lean-lf.xml",
+		"<r><s a='x>y' b=\"/>\">text<![CDATA[</s>]]><!-- </s> -->\n"
+		"<?pi </s>?><n><n/>&lt;&#65;<n a='</s>'>x</n></n>\n"
+		"</s><t/></r>",
+
+		"lean-crlf.xml",
+		"<r><s a='x>y' b=\"/>\">text<![CDATA[</s>]]><!-- </s> -->\r\n"
+		"<?pi </s>?><n><n/>&lt;&#65;<n a='</s>'>x</n></n>\r\n"
+		"</s><t/></r>",
+
+		"doctype-lf.xml",
+		"<!DOCTYPE r [<!ENTITY e '<n>&lt;/s></n>'>]><r><s a='x>y' b=\"/>\">text<![CDATA[</s>]]><!-- </s> -->\n"
+		"<?pi </s>?><n><n/>&lt;&#65;&e;<n a='</s>'>x</n></n>\n"
+		"</s><t/></r>",
+
+		"doctype-crlf.xml",
+		"<!DOCTYPE r [<!ENTITY e '<n>&lt;/s></n>'>]><r><s a='x>y' b=\"/>\">text<![CDATA[</s>]]><!-- </s> -->\r\n"
+		"<?pi </s>?><n><n/>&lt;&#65;&e;<n a='</s>'>x</n></n>\r\n"
+		"</s><t/></r>"
+	};
+
+	for (size_t i = 0;i < sizeof(docs) / sizeof(docs[0]);i += 2)
+		add_doc(resolver,docs[i],docs[i+1]);
+
+	Tokenizer tok(allocator);
+	tok.set_resolver(resolver);
+
+	OOBase::LocalString attrs(allocator);
+	OOBase::LocalString str(allocator);
+	for (size_t i = 0;i < sizeof(docs) / sizeof(docs[0]);i += 2)
+	{
+		for (int content = 0;content < 2;++content)
+		{
+			// The end tag of <s> is on line 3, and the depth is right if the rest parses
+			CHECK(skip_s(tok,docs[i],content != 0,attrs,str) == 3);
+			CHECK(!strncmp(str.c_str(),"<t ",3));
+			CHECK(ends_with(str," /r $"));
+			CHECK(!contains(str,"n"));
+
+			if (content)
+				CHECK(!strcmp(attrs.c_str(),"@a =x>y @b =/>"));
+		}
+	}
+}
+
+namespace
+{
+	bool select(CatalogResolver& resolver, const char* path, const char* expected)
+	{
+		OOBase::ArenaAllocator allocator;
+		Tokenizer tok(allocator);
+		tok.set_resolver(resolver);
+
+		PathFilter pf(allocator);
+		size_t id = 0;
+		if (pf.add(path,id) != 0 || id != 0)
+			return false;
+
+		OOBase::LocalString str(allocator);
+		if (filter(pf,tok,"library.xml",str) != Tokenizer::End)
+			return false;
+
+		if (strcmp(str.c_str(),expected) != 0)
+		{
+			fprintf(stderr,"%s selected: %s\n",path,str.c_str());
+			return false;
+		}
+		return true;
+	}
+}
+
+static void test_path_filter()
+{
+	OOBase::ArenaAllocator allocator;
+	CatalogResolver resolver(allocator);
+
+	add_doc(resolver,"library.xml",
+			"<lib><book id='1' lang='en'><title>A</title><author>X</author></book>"
+			"<shelf><book id='2'><title>B</title></book></shelf>"
+			"<mag id='3'><title>C</title></mag></lib>");
+
+	CHECK(select(resolver,"/lib/book/title","<title \"A /title $"));
+	CHECK(select(resolver,"//title","<title \"A /title <title \"B /title <title \"C /title $"));
+	CHECK(select(resolver,"/lib/*/title","<title \"A /title <title \"C /title $"));
+	CHECK(select(resolver,"/lib//book/title/text()","\"A \"B $"));
+	CHECK(select(resolver,"//book[@id='2']/title","<title \"B /title $"));
+	CHECK(select(resolver,"//book/@id","@id =1 @id =2 $"));
+	CHECK(select(resolver,"/lib/mag/@*","@id =3 $"));
+	CHECK(select(resolver,"/lib/shelf","<shelf <book @id =2 <title \"B /title /book /shelf $"));
+	CHECK(select(resolver,"/book","$"));
+
+	// Each token carries the index of the path that selected it
+	Tokenizer tok(allocator);
+	tok.set_resolver(resolver);
+
+	PathFilter pf(allocator);
+	size_t title = 0;
+	size_t id = 0;
+	CHECK(pf.add("//title/text()",title) == 0);
+	CHECK(pf.add("//@id",id) == 0);
+	CHECK(title == 0 && id == 1);
+	CHECK(pf.add("/lib/[",id) == EINVAL);
+
+	load(tok,"library.xml");
+	pf.reset();
+
+	OOBase::LocalString strToken(allocator);
+	size_t texts = 0;
+	size_t ids = 0;
+	for (;;)
+	{
+		size_t path = PathFilter::npos;
+		Tokenizer::TokenType type = pf.next_token(tok,strToken,path);
+		if (type == Tokenizer::End || type == Tokenizer::Error)
+		{
+			CHECK(type == Tokenizer::End);
+			break;
+		}
+
+		if (type == Tokenizer::Text)
+		{
+			CHECK(path == title);
+			++texts;
+		}
+		else
+		{
+			CHECK(path == id);
+			CHECK(type == Tokenizer::AttributeName || type == Tokenizer::AttributeValue);
+			++ids;
+		}
+	}
+	CHECK(texts == 3);
+	CHECK(ids == 6);
+}
+
+static void test_suppress()
+{
+	OOBase::ArenaAllocator allocator;
+	CatalogResolver resolver(allocator);
+
+	add_doc(resolver,"lean.xml","<r><a x='1'>t</a><!--c--><?p d?><![CDATA[z]]> </r>");
+	add_doc(resolver,"dtd.xml",
+			"<!DOCTYPE r [<!ATTLIST a d CDATA 'def'>]>"
+			"<r><a x='1'><c></c>t</a><!--c--><?p d?><![CDATA[z]]> <b></b></r>");
+
+	Tokenizer tok(allocator);
+	tok.set_resolver(resolver);
+
+	// Suppressed tokens are dropped, with or without a DTD that still sees them
+	tok.set_suppress((1u << Tokenizer::Comment) | (1u << Tokenizer::PiData) | (1u << Tokenizer::CData) | Tokenizer::WhitespaceText);
+
+	OOBase::LocalString str(allocator);
+	CHECK(parse(tok,"lean.xml",str) == Tokenizer::End);
+	CHECK(!strcmp(str.c_str(),"<r <a @x =1 \"t /a /r $"));
+
+	CHECK(parse(tok,"dtd.xml",str) == Tokenizer::End);
+	CHECK(ends_with(str,"<r <a @x =1 @d =def <c /c \"t /a <b /b /r $"));
+
+	// Without their ElementStart, elements still nest, and keep their own attributes
+	tok.set_suppress(1u << Tokenizer::ElementStart);
+
+	CHECK(parse(tok,"dtd.xml",str) == Tokenizer::End);
+	CHECK(!contains(str,"<r") && !contains(str,"<a") && !contains(str,"<b") && !contains(str,"<c"));
+	CHECK(ends_with(str,"@x =1 @d =def /c \"t /a #c ?p d [z \"  /b /r $"));
+
+	// Skipping from an attribute of an element whose start was suppressed
+	load(tok,"dtd.xml");
+
+	OOBase::LocalString strToken(allocator);
+	Tokenizer::TokenType type;
+	while ((type = tok.next_token(strToken,0)) != Tokenizer::AttributeName)
+	{
+		if (type == Tokenizer::End || type == Tokenizer::Error)
+			break;
+	}
+	CHECK(type == Tokenizer::AttributeName && strToken == "x");
+	CHECK(tok.skip_element() == Tokenizer::ElementEnd);
+
+	str.clear();
+	do
+	{
+		type = tok.next_token(strToken,0);
+		append_token(str,type,strToken);
+	}
+	while (type != Tokenizer::End && type != Tokenizer::Error);
+
+	CHECK(!strcmp(str.c_str(),"#c ?p d [z \"  /b /r $"));
+
+	tok.set_suppress(0);
+}
+
+static void test_pool()
+{
+	OOBase::ArenaAllocator allocator;
+	CatalogResolver resolver(allocator);
+
+	add_doc(resolver,"shared.xml","<!DOCTYPE s [<!ENTITY foo 'bar'>]><s/>");
+	add_doc(resolver,"catalog.xml","<!DOCTYPE r><r><!--c-->&foo;</r>");
+
+	TokenizerPool pool(allocator,1);
+
+	Tokenizer* tok = pool.acquire();
+	tok->set_resolver(resolver);
+
+	OOBase::LocalString str(allocator);
+	CHECK(parse(*tok,"shared.xml",str) == Tokenizer::End);
+
+	EntityTable* shared = tok->share_entities(allocator);
+	tok->set_entities(shared);
+	shared->release();
+
+	tok->set_suppress(1u << Tokenizer::Comment);
+	CHECK(parse(*tok,"catalog.xml",str) == Tokenizer::End);
+	CHECK(ends_with(str,"<r \"bar /r $"));
+	CHECK(!contains(str,"#c"));
+
+	pool.release(tok);
+
+	// The same Tokenizer comes back with none of the last user's settings
+	Tokenizer* tok2 = pool.acquire();
+	CHECK(tok2 == tok);
+
+	bool found = true;
+	try
+	{
+		load(*tok2,"catalog.xml");
+	}
+	catch (const char*)
+	{
+		found = false;
+	}
+	CHECK(!found);
+
+	tok2->set_resolver(resolver);
+	CHECK(parse(*tok2,"catalog.xml",str) == Tokenizer::Error);
+	CHECK(contains(str,"#c"));
+	CHECK(!contains(str,"bar"));
+
+	pool.release(tok2);
+}
+
+namespace
+{
+	const size_t batch_docs = 40;
+
+	// Each call is for a different document, so the slots need no lock
+	class BatchResults : public BatchParser::Handler
+	{
+	public:
+		BatchResults()
+		{
+			memset(m_results,0,sizeof(m_results));
+			memset(m_texts,0,sizeof(m_texts));
+			memset(m_seen,0,sizeof(m_seen));
+		}
+
+		virtual bool token(size_t doc, Tokenizer::TokenType type, const OOBase::LocalString& strToken)
+		{
+			if (type == Tokenizer::Text && doc < batch_docs)
+				m_texts[doc] = strtoul(strToken.c_str(),NULL,10);
+			return true;
+		}
+
+		virtual void result(const BatchParser::Result& res)
+		{
+			if (res.m_doc < batch_docs)
+			{
+				m_results[res.m_doc] = res;
+				m_results[res.m_doc].m_fname = NULL;
+				m_results[res.m_doc].m_error = NULL;
+				++m_seen[res.m_doc];
+			}
+		}
+
+		BatchParser::Result m_results[batch_docs];
+		unsigned long       m_texts[batch_docs];
+		size_t              m_seen[batch_docs];
+	};
+}
+
+static void test_batch()
+{
+	OOBase::ArenaAllocator allocator;
+	CatalogResolver resolver(allocator);
+
+	// Every fifth document is not well-formed
+	static char names[batch_docs][16];
+	static char texts[batch_docs][32];
+	BatchParser batch(allocator,4);
+	for (size_t i = 0;i < batch_docs;++i)
+	{
+		snprintf(names[i],sizeof(names[i]),"doc%lu.xml",(unsigned long)i);
+		snprintf(texts[i],sizeof(texts[i]),(i % 5 == 4 ? "<r>%lu</x>" : "<r>%lu</r>"),(unsigned long)i);
+
+		add_doc(resolver,names[i],texts[i]);
+		CHECK(batch.add(names[i]) == 0);
+	}
+	batch.set_resolver(resolver);
+
+	BatchResults results;
+	batch.run(results);
+
+	for (size_t i = 0;i < batch_docs;++i)
+	{
+		CHECK(results.m_seen[i] == 1);
+		CHECK(results.m_results[i].m_doc == i);
+		CHECK(results.m_results[i].m_wf == (i % 5 != 4));
+		CHECK(results.m_texts[i] == i);
+	}
+}
+
+static void test_tokenized_attributes()
+{
+	OOBase::ArenaAllocator allocator;
+	CatalogResolver resolver(allocator);
+
+	add_doc(resolver,"tokenized.xml",
+			"<!DOCTYPE r [<!ATTLIST r t NMTOKENS #IMPLIED c CDATA #IMPLIED>]>"
+			"<r t='  a&#9;b \n c&#10;&#13;d  ' c='  a&#9;b \n c  '/>");
+
+	Tokenizer tok(allocator);
+	tok.set_resolver(resolver);
+
+	// Literal white space is normalised to #x20 first, and only #x20 is collapsed
+	OOBase::LocalString str(allocator);
+	CHECK(parse(tok,"tokenized.xml",str) == Tokenizer::End);
+	CHECK(contains(str,"@t =a\tb c\n\rd @c"));
+	CHECK(contains(str,"@c =  a\tb   c  "));
+}
+
+static void test_runs()
+{
+	OOBase::ArenaAllocator allocator;
+	CatalogResolver resolver(allocator);
+
+	// Runs of plain characters are read in one go, up to whatever needs the machine
+	add_doc(resolver,"runs.xml","<r a='x y]z\"&amp;w\tv'>line1\r\nline2 ]]&gt; a]b<b/>tail</r>");
+
+	Tokenizer tok(allocator);
+	tok.set_resolver(resolver);
+
+	OOBase::LocalString str(allocator);
+	CHECK(parse(tok,"runs.xml",str) == Tokenizer::End);
+	CHECK(contains(str,"<r @a =x y]z\"&w v \"line1\nline2 ]]"));
+	CHECK(ends_with(str," a]b <b /b \"tail /r $"));
+}
+
+namespace
+{
+	bool write_bytes(const char* fname, const void* data, size_t len)
+	{
+		FILE* f = fopen(fname,"wb");
+		if (!f)
+			return false;
+
+		bool ok = (fwrite(data,1,len,f) == len);
+		return (fclose(f) == 0 && ok);
+	}
+
+	// As parse, but through a Pipeline, leaving the text of the last token in strLast
+	Tokenizer::TokenType pipe(OOBase::AllocatorInstance& allocator, const char* fname, OOBase::LocalString& str, OOBase::LocalString& strLast)
+	{
+		str.clear();
+
+		Pipeline pipeline(allocator);
+		pipeline.start(fname);
+
+		for (;;)
+		{
+			Tokenizer::TokenType type = pipeline.next_token(strLast);
+			append_token(str,type,strLast);
+			if (type == Tokenizer::End || type == Tokenizer::Error)
+				return type;
+		}
+	}
+
+	// The Pipeline must produce exactly the tokens a single Tokenizer does
+	bool same_tokens(Tokenizer& tok, const char* fname)
+	{
+		OOBase::LocalString str(tok.get_allocator()),str2(tok.get_allocator()),strLast(tok.get_allocator());
+		Tokenizer::TokenType type = parse(tok,fname,str);
+		return (pipe(tok.get_allocator(),fname,str2,strLast) == type && !strcmp(str.c_str(),str2.c_str()));
+	}
+}
+
+static void test_pipeline()
+{
+	OOBase::ArenaAllocator allocator;
+	Tokenizer tok(allocator);
+
+	// Several times more than the rings hold, so every stage has to wait for the next
+	const size_t count = 4 * Pipeline::ring_size * Pipeline::block_size / 12;
+	CHECK(write_file("ooxml-test.xml",count));
+	CHECK(same_tokens(tok,"ooxml-test.xml"));
+
+	// Stopping part way through must not wait for the rest of the file
+	{
+		Pipeline pipeline(allocator);
+		pipeline.start("ooxml-test.xml");
+
+		OOBase::LocalString strToken(allocator);
+		for (size_t i = 0;i < 10;++i)
+			CHECK(pipeline.next_token(strToken) != Tokenizer::Error);
+	}
+
+	// UTF-16LE, after a BOM
+	static const char utf8[] = "<?xml version='1.0' encoding='UTF-16'?><r a='v'>text<b/>\r\n</r>";
+	unsigned char utf16[2 + 2 * sizeof(utf8)] = { 0xFF, 0xFE };
+	for (size_t i = 0;i < sizeof(utf8) - 1;++i)
+		utf16[2 + 2 * i] = utf8[i];
+
+	CHECK(write_bytes("ooxml-test.xml",utf16,2 + 2 * (sizeof(utf8) - 1)));
+	CHECK(same_tokens(tok,"ooxml-test.xml"));
+
+	// The tokens before a syntax error, then the reason
+	static const char bad[] = "<r><a>text</b></r>";
+	CHECK(write_bytes("ooxml-test.xml",bad,sizeof(bad) - 1));
+	CHECK(same_tokens(tok,"ooxml-test.xml"));
+
+	OOBase::LocalString str(allocator),strLast(allocator);
+	CHECK(pipe(allocator,"ooxml-test.xml",str,strLast) == Tokenizer::Error);
+	CHECK(!strncmp(strLast.c_str(),"Syntax error at ",16));
+	CHECK(contains(strLast,"line 1"));
+
+	remove("ooxml-test.xml");
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+namespace
+{
+	// Hands out a buffer step bytes at a time
+	class MemorySource : public BlockSource
+	{
+	public:
+		MemorySource(const unsigned char* p, size_t len, size_t step) : m_p(p), m_len(len), m_step(step)
+		{}
+
+		virtual const unsigned char* next(size_t& len)
+		{
+			len = (m_len < m_step ? m_len : m_step);
+			const unsigned char* p = m_p;
+			m_p += len;
+			m_len -= len;
+			return p;
+		}
+
+	private:
+		const unsigned char* m_p;
+		size_t               m_len;
+		size_t               m_step;
+	};
+
+	// A buffer of lines of text, which compress well
+	struct Buffer
+	{
+		Buffer(OOBase::AllocatorInstance& allocator, size_t len) : m_allocator(allocator), m_len(len)
+		{
+			m_data = static_cast<unsigned char*>(allocator.allocate(len ? len : 1,16));
+			if (!m_data)
+				throw "Out of memory";
+		}
+
+		~Buffer()
+		{
+			m_allocator.free(m_data);
+		}
+
+		void fill()
+		{
+			for (size_t i = 0;i < m_len;++i)
+				m_data[i] = ((i % 64) == 63 ? '\n' : 'a' + static_cast<unsigned char>((i / 64 + i) % 26));
+		}
+
+		OOBase::AllocatorInstance& m_allocator;
+		unsigned char*             m_data;
+		size_t                     m_len;
+	};
+
+	// Decompresses everything, returning NULL if it matches expect, or the reason if not
+	const char* decompress(OOBase::AllocatorInstance& allocator, const Buffer& in, size_t in_len, size_t step, const Buffer& expect)
+	{
+		MemorySource source(in.m_data,in_len,step);
+		Decompressor* d = Decompressor::create(allocator,source);
+		if (!d)
+			throw "Out of memory";
+
+		const char* err = NULL;
+		try
+		{
+			size_t pos = 0;
+			for (;;)
+			{
+				size_t len = 0;
+				const unsigned char* p = d->next(len);
+				if (!len)
+					break;
+
+				// Every block is full, but the last
+				if (pos % Decompressor::block_size || pos + len > expect.m_len || memcmp(p,expect.m_data + pos,len))
+				{
+					err = "Mismatch";
+					break;
+				}
+				pos += len;
+			}
+
+			if (!err && pos != expect.m_len)
+				err = "Short";
+		}
+		catch (const char* e)
+		{
+			err = e;
+		}
+
+		d->destroy();
+		return err;
+	}
+
+	// Checks all of the members or frames, then the first with its end cut off,
+	// handed in a few bytes at a time up to more than a whole block.
+	// The format is sniffed from the first 4 bytes, so they must arrive together.
+	void check_compressed(OOBase::AllocatorInstance& allocator, const Buffer& in, size_t first_len, const Buffer& expect)
+	{
+		static const size_t steps[] = { 5, 4096, Decompressor::block_size + 1 };
+		for (size_t i = 0;i < sizeof(steps) / sizeof(steps[0]);++i)
+		{
+			CHECK(!decompress(allocator,in,in.m_len,steps[i],expect));
+
+			// An error from the Decompressor, not just short output
+			const char* err = decompress(allocator,in,first_len - 3,steps[i],expect);
+			CHECK(err && !strncmp(err,"Truncated",9));
+		}
+	}
+}
+#endif
+
+#if defined(HAVE_ZLIB)
+namespace
+{
+	size_t gzip(const unsigned char* p, size_t len, unsigned char* out, size_t out_len)
+	{
+		z_stream z;
+		memset(&z,0,sizeof(z));
+		if (deflateInit2(&z,Z_DEFAULT_COMPRESSION,Z_DEFLATED,16 + MAX_WBITS,8,Z_DEFAULT_STRATEGY) != Z_OK)
+			throw "Out of memory";
+
+		z.next_in = const_cast<Bytef*>(p);
+		z.avail_in = static_cast<uInt>(len);
+		z.next_out = out;
+		z.avail_out = static_cast<uInt>(out_len);
+		int err = deflate(&z,Z_FINISH);
+		deflateEnd(&z);
+		if (err != Z_STREAM_END)
+			throw "deflate failed";
+
+		return out_len - z.avail_out;
+	}
+}
+
+static void test_gzip()
+{
+	OOBase::ArenaAllocator allocator;
+
+	// Two members, ending exactly on a block boundary
+	Buffer plain(allocator,2 * Decompressor::block_size);
+	plain.fill();
+
+	Buffer gz(allocator,plain.m_len);
+	size_t first = gzip(plain.m_data,plain.m_len / 3,gz.m_data,gz.m_len);
+	gz.m_len = first + gzip(plain.m_data + plain.m_len / 3,plain.m_len - plain.m_len / 3,gz.m_data + first,gz.m_len - first);
+
+	check_compressed(allocator,gz,first,plain);
+
+	// A truncated document is an error, even though its text is all there
+	static const char doc[] = "<r>text</r>";
+	unsigned char doc_gz[256];
+	size_t len = gzip(reinterpret_cast<const unsigned char*>(doc),sizeof(doc) - 1,doc_gz,sizeof(doc_gz));
+
+	OOBase::LocalString str(allocator);
+	Tokenizer tok(allocator);
+	CHECK(write_bytes("ooxml-test.xml",doc_gz,len));
+	CHECK(parse(tok,"ooxml-test.xml",str) == Tokenizer::End);
+	CHECK(write_bytes("ooxml-test.xml",doc_gz,len - 4));
+	CHECK(parse(tok,"ooxml-test.xml",str) == Tokenizer::Error);
+
+	remove("ooxml-test.xml");
+}
+#endif
+
+#if defined(HAVE_ZSTD)
+static void test_zstd()
+{
+	OOBase::ArenaAllocator allocator;
+
+	// Two frames, ending exactly on a block boundary
+	Buffer plain(allocator,2 * Decompressor::block_size);
+	plain.fill();
+
+	Buffer zst(allocator,ZSTD_compressBound(plain.m_len / 3) + ZSTD_compressBound(plain.m_len));
+	size_t first = ZSTD_compress(zst.m_data,zst.m_len,plain.m_data,plain.m_len / 3,1);
+	CHECK(!ZSTD_isError(first));
+	size_t second = ZSTD_compress(zst.m_data + first,zst.m_len - first,plain.m_data + plain.m_len / 3,plain.m_len - plain.m_len / 3,1);
+	CHECK(!ZSTD_isError(second));
+	zst.m_len = first + second;
+
+	check_compressed(allocator,zst,first,plain);
+}
+#endif
+
+static void run(const char* name, void (*test)())
+{
+	int before = failures;
+	try
+	{
+		(*test)();
+	}
+	catch (const char* e)
+	{
+		fprintf(stderr,"%s: exception %s\n",name,e);
+		++failures;
+	}
+
+	if (failures != before)
+		fprintf(stderr,"FAIL: %s\n",name);
+}
+
+int main()
+{
+	run("shared_entities",&test_shared_entities);
+	run("path_filter_defaults",&test_path_filter_defaults);
+	run("offsets",&test_offsets);
+	run("file_sizes",&test_file_sizes);
+	run("skip",&test_skip);
+	run("path_filter",&test_path_filter);
+	run("suppress",&test_suppress);
+	run("pool",&test_pool);
+	run("batch",&test_batch);
+	run("tokenized_attributes",&test_tokenized_attributes);
+	run("runs",&test_runs);
+	run("pipeline",&test_pipeline);
+#if defined(HAVE_ZLIB)
+	run("gzip",&test_gzip);
+#endif
+#if defined(HAVE_ZSTD)
+	run("zstd",&test_zstd);
+#endif
+
+	return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}